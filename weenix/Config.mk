@@ -72,10 +72,13 @@
         UPREEMPT=0 # userland preemption
              MTP=0 # multiple kernel threads per process
          SHADOWD=0 # shadow page cleanup
+        LOCKSTAT=0 # mutex contention statistics (the lockstat kshell command)
+             SMP=0 # start the other processors (they only idle so far; run
+                   # qemu with -smp to have any)
 
 # Boolean options specified in this specified in this file that should be
 # included as definitions at compile time
-        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT"
+        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT LOCKSTAT SMP"
 # As above, but not booleans
         COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE BOCHS_INSTALL_DIR"
 
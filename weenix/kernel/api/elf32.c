@@ -656,6 +656,10 @@ static int _elf32_load(const char *filename, int fd, char *const argv[],
         /* the final threshold / What warm unspoken secrets will we learn? / Beyond
          * the point of no return ... */
 
+        /* A vfork child hands its parent's address space back here, so that
+         * the map and page table torn down below are its own. */
+        proc_vfork_release(curproc);
+
         /* Give the process the new mappings. */
         vmmap_t *tempmap = curproc->p_vmmap;
         curproc->p_vmmap = map;
@@ -664,8 +668,10 @@ static int _elf32_load(const char *filename, int fd, char *const argv[],
         map->vmm_proc = NULL;
 
         /* Flush the process pagetables and TLB */
-        pt_unmap_range(curproc->p_pagedir, USER_MEM_LOW, USER_MEM_HIGH);
-        tlb_flush_all();
+        tlb_gather_t tg;
+        tlb_gather_init(&tg, curproc->p_pagedir);
+        pt_unmap_range_gather(&tg, USER_MEM_LOW, USER_MEM_HIGH);
+        tlb_gather_finish(&tg);
 
         /* Set the process break and starting break (immediately after the mapped-in
          * text/data/bss from the executable) */
@@ -1,8 +1,19 @@
+#include "globals.h"
+#include "errno.h"
+
 #include "util/debug.h"
 
 #include "main/interrupt.h"
 #include "main/gdt.h"
 
+#include "mm/pagetable.h"
+
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#include "fs/file.h"
+#include "fs/vfs_syscall.h"
+
 #include "api/exec.h"
 #include "api/binfmt.h"
 #include "api/syscall.h"
@@ -15,6 +26,7 @@
  */
 void userland_entry(const regs_t *regs)
 {
+        pt_set_user(curproc->p_pagedir);
         intr_disable();
         intr_setipl(IPL_LOW);
         /* We "return from the interrupt" to get into userland */
@@ -48,12 +60,10 @@ int do_execve(const char *filename, char *const *argv, char *const *envp, struct
         return 0;
 }
 
-void kernel_execve(const char *filename, char *const *argv, char *const *envp)
+/* Enters a freshly loaded binary from a kernel-only thread, given the
+ * instruction and stack pointers binfmt_load returned. Does not return. */
+static void exec_enter_userland(uint32_t eip, uint32_t esp)
 {
-        uint32_t eip, esp;
-        int ret = binfmt_load(filename, argv, envp, &eip, &esp);
-        KASSERT(0 == ret); /* Should never fail to load the first binary */
-
         dbg(DBG_EXEC, "Entering userland with eip %#08x, esp %#08x\n", eip, esp);
 
         /* To enter userland, we build a set of saved registers to "trick" the processor
@@ -95,3 +105,108 @@ void kernel_execve(const char *filename, char *const *argv, char *const *envp)
         regs.r_esp = 0;
         userland_entry(&regs);
 }
+
+void kernel_execve(const char *filename, char *const *argv, char *const *envp)
+{
+        uint32_t eip, esp;
+        int ret = binfmt_load(filename, argv, envp, &eip, &esp);
+        KASSERT(0 == ret); /* Should never fail to load the first binary */
+
+        exec_enter_userland(eip, esp);
+}
+
+/* What a spawning parent hands its child, and how the child reports back */
+typedef struct spawn_req {
+        const char                *sr_filename;
+        char *const               *sr_argv;
+        char *const               *sr_envp;
+        const spawn_file_action_t *sr_actions;
+        int                        sr_nactions;
+
+        int                        sr_done;   /* child has finished loading */
+        int                        sr_err;    /* and how that went */
+        ktqueue_t                  sr_waitq;  /* parent waits here */
+} spawn_req_t;
+
+/* The first (kernel) thread of a spawned process. Applies the file actions
+ * and loads the binary, then tells the parent how it went. The request
+ * lives on the parent's stack, so it must not be touched after that. */
+static void *spawn_child_run(int arg1, void *arg2)
+{
+        spawn_req_t *req = (spawn_req_t *) arg2;
+        uint32_t eip, esp;
+        int i, err = 0;
+
+        for (i = 0; i < req->sr_nactions && 0 <= err; i++) {
+                const spawn_file_action_t *fa = &req->sr_actions[i];
+                if (-1 == fa->sfa_newfd) {
+                        err = do_close(fa->sfa_fd);
+                } else {
+                        err = do_dup2(fa->sfa_fd, fa->sfa_newfd);
+                }
+        }
+        if (0 <= err) {
+                err = binfmt_load(req->sr_filename, req->sr_argv, req->sr_envp, &eip, &esp);
+        }
+
+        req->sr_err = (0 > err) ? err : 0;
+        req->sr_done = 1;
+        sched_wakeup_on(&req->sr_waitq);
+
+        if (0 > err) {
+                do_exit(127);
+                panic("exit failed!\n");
+        }
+        exec_enter_userland(eip, esp);
+        return NULL;
+}
+
+int do_spawn(const char *filename, char *const *argv, char *const *envp,
+             const spawn_file_action_t *actions, int nactions)
+{
+        spawn_req_t req;
+        proc_t *child;
+        kthread_t *thr;
+        pid_t pid;
+        int fd, status;
+
+        KASSERT(0 <= nactions && SPAWN_MAX_ACTIONS >= nactions);
+
+        if (NULL == (child = proc_create(curproc->p_comm))) {
+                return -ENOMEM;
+        }
+        pid = child->p_pid;
+
+        req.sr_filename = filename;
+        req.sr_argv = argv;
+        req.sr_envp = envp;
+        req.sr_actions = actions;
+        req.sr_nactions = nactions;
+        req.sr_done = 0;
+        req.sr_err = 0;
+        sched_queue_init(&req.sr_waitq);
+
+        if (NULL == (thr = kthread_create(child, spawn_child_run, 0, &req))) {
+                /* Nothing has run in the child, so there is nothing to wait for */
+                proc_destroy(child);
+                return -ENOMEM;
+        }
+
+        /* proc_create() already gave the child our working directory */
+        for (fd = 0; fd < NFILES; fd++) {
+                if (NULL != (child->p_files[fd] = curproc->p_files[fd])) {
+                        fref(child->p_files[fd]);
+                }
+        }
+
+        sched_make_runnable(thr);
+        while (!req.sr_done) {
+                sched_sleep_on(&req.sr_waitq);
+        }
+
+        if (0 > req.sr_err) {
+                do_waitpid(pid, 0, &status);
+                return req.sr_err;
+        }
+        return pid;
+}
@@ -7,11 +7,13 @@
 
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/futex.h"
 
 #include "util/init.h"
 #include "util/string.h"
 #include "util/debug.h"
 #include "util/list.h"
+#include "util/time.h"
 
 #include "mm/mman.h"
 #include "mm/mm.h"
@@ -30,6 +32,7 @@
 
 #include "api/syscall.h"
 #include "api/utsname.h"
+#include "api/time.h"
 #include "api/access.h"
 #include "api/exec.h"
 
@@ -426,6 +429,24 @@ static int sys_munmap(munmap_args_t *args)
         return 0;
 }
 
+static int sys_madvise(madvise_args_t *args)
+{
+        madvise_args_t          kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(madvise_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_madvise(kargs.addr, kargs.len, kargs.advice);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
 static void *sys_mmap(mmap_args_t *arg)
 {
         mmap_args_t             kargs;
@@ -443,9 +464,191 @@ static void *sys_mmap(mmap_args_t *arg)
                 curthr->kt_errno = -err;
                 return MAP_FAILED;
         }
+
+        /* like Linux, failing to populate the mapping does not fail mmap */
+        err = do_mmap_populate(ret, kargs.mma_len, kargs.mma_flags);
+        if (err < 0) {
+                dbg(DBG_VM, "failed to populate mapping at %p: %d\n", ret, err);
+        }
         return ret;
 }
 
+static int sys_mlock(mlock_args_t *args)
+{
+        mlock_args_t            kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(mlock_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_mlock(kargs.addr, kargs.len);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_munlock(mlock_args_t *args)
+{
+        mlock_args_t            kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(mlock_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_munlock(kargs.addr, kargs.len);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_getrusage(getrusage_args_t *args)
+{
+        getrusage_args_t        kargs;
+        struct rusage           ru;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(getrusage_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        if ((err = do_getrusage(kargs.who, &ru)) < 0
+            || (err = copy_to_user(kargs.usage, &ru, sizeof(ru))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_nice(int incr)
+{
+        return do_nice(incr);
+}
+
+static int sys_getrlimit(rlimit_args_t *args)
+{
+        rlimit_args_t           kargs;
+        struct rlimit           rlim;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(rlimit_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        if ((err = do_getrlimit(kargs.resource, &rlim)) < 0
+            || (err = copy_to_user(kargs.rlim, &rlim, sizeof(rlim))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_setrlimit(rlimit_args_t *args)
+{
+        rlimit_args_t           kargs;
+        struct rlimit           rlim;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(rlimit_args_t))
+            || copy_from_user(&rlim, kargs.rlim, sizeof(rlim))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        if ((err = do_setrlimit(kargs.resource, &rlim)) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+
+static int sys_futex(futex_args_t *args)
+{
+        futex_args_t            kargs;
+        int                     ret;
+
+        if (copy_from_user(&kargs, args, sizeof(futex_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        switch (kargs.op) {
+                case FUTEX_WAIT:
+                        ret = do_futex_wait(kargs.uaddr, kargs.val);
+                        break;
+                case FUTEX_WAKE:
+                        ret = do_futex_wake(kargs.uaddr, kargs.val);
+                        break;
+                default:
+                        ret = -EINVAL;
+                        break;
+        }
+
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+static int sys_nanosleep(nanosleep_args_t *args)
+{
+        nanosleep_args_t        kargs;
+        struct timespec         req, rem;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(nanosleep_args_t))
+            || copy_from_user(&req, kargs.req, sizeof(req))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        if ((err = do_nanosleep(&req, &rem)) < 0) {
+                if (-EINTR == err && NULL != kargs.rem
+                    && copy_to_user(kargs.rem, &rem, sizeof(rem)) < 0) {
+                        err = -EFAULT;
+                }
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_clock_gettime(clock_gettime_args_t *args)
+{
+        clock_gettime_args_t    kargs;
+        struct timespec         ts;
+        uint64_t                ns;
+
+        if (copy_from_user(&kargs, args, sizeof(clock_gettime_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        if (CLOCK_MONOTONIC != kargs.clock_id) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        ns = ktime_ns();
+        ts.tv_sec = ns / NSEC_PER_SEC;
+        ts.tv_nsec = ns % NSEC_PER_SEC;
+        if (copy_to_user(kargs.tp, &ts, sizeof(ts))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+        return 0;
+}
 
 static pid_t sys_waitpid(waitpid_args_t *args)
 {
@@ -572,6 +775,16 @@ static int sys_fork(regs_t *regs)
         return ret;
 }
 
+static int sys_vfork(regs_t *regs)
+{
+        int ret = do_vfork(regs);
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
 static void free_vector(char **vect)
 {
         char **temp;
@@ -625,6 +838,65 @@ cleanup:
         return 0;
 }
 
+static int sys_spawn(spawn_args_t *args)
+{
+        spawn_args_t kern_args;
+        spawn_file_action_t kern_actions[SPAWN_MAX_ACTIONS];
+        char *kern_filename = NULL;
+        char **kern_argv = NULL;
+        char **kern_envp = NULL;
+        int ret = -1;
+        int err;
+
+        if ((err = copy_from_user(&kern_args, args, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -err;
+                goto cleanup;
+        }
+
+        /* copy the file actions */
+        if (kern_args.nactions > SPAWN_MAX_ACTIONS) {
+                curthr->kt_errno = EINVAL;
+                goto cleanup;
+        }
+        if (kern_args.nactions > 0 &&
+            (err = copy_from_user(kern_actions, kern_args.actions,
+                                  kern_args.nactions * sizeof(spawn_file_action_t))) < 0) {
+                curthr->kt_errno = -err;
+                goto cleanup;
+        }
+
+        /* copy the name of the executable */
+        if ((kern_filename = user_strdup(&kern_args.filename)) == NULL)
+                goto cleanup;
+
+        /* copy the argument list */
+        if (kern_args.argv.av_vec) {
+                if ((kern_argv = user_vecdup(&kern_args.argv)) == NULL)
+                        goto cleanup;
+        }
+
+        /* copy the environment list */
+        if (kern_args.envp.av_vec) {
+                if ((kern_envp = user_vecdup(&kern_args.envp)) == NULL)
+                        goto cleanup;
+        }
+
+        if ((ret = do_spawn(kern_filename, kern_argv, kern_envp,
+                            kern_actions, (int) kern_args.nactions)) < 0) {
+                curthr->kt_errno = -ret;
+                ret = -1;
+        }
+
+cleanup:
+        if (kern_filename)
+                kfree(kern_filename);
+        if (kern_argv)
+                free_vector(kern_argv);
+        if (kern_envp)
+                free_vector(kern_envp);
+        return ret;
+}
+
 static int sys_debug(argstr_t *arg)
 {
         argstr_t kern_args;
@@ -723,6 +995,9 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_fork:
                         return sys_fork(regs);
 
+                case SYS_vfork:
+                        return sys_vfork(regs);
+
                 case SYS_getpid:
                         return curproc->p_pid;
 
@@ -744,6 +1019,36 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_munmap:
                         return sys_munmap((munmap_args_t *) args);
 
+                case SYS_madvise:
+                        return sys_madvise((madvise_args_t *) args);
+
+                case SYS_mlock:
+                        return sys_mlock((mlock_args_t *) args);
+
+                case SYS_munlock:
+                        return sys_munlock((mlock_args_t *) args);
+
+                case SYS_getrusage:
+                        return sys_getrusage((getrusage_args_t *) args);
+
+                case SYS_nice:
+                        return sys_nice((int)args);
+
+                case SYS_getrlimit:
+                        return sys_getrlimit((rlimit_args_t *) args);
+
+                case SYS_setrlimit:
+                        return sys_setrlimit((rlimit_args_t *) args);
+
+                case SYS_futex:
+                        return sys_futex((futex_args_t *) args);
+
+                case SYS_nanosleep:
+                        return sys_nanosleep((nanosleep_args_t *) args);
+
+                case SYS_clock_gettime:
+                        return sys_clock_gettime((clock_gettime_args_t *) args);
+
                 case SYS_open:
                         return sys_open((open_args_t *) args);
 
@@ -803,6 +1108,9 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_execve:
                         return sys_execve((execve_args_t *)args, regs);
 
+                case SYS_spawn:
+                        return sys_spawn((spawn_args_t *)args);
+
                 case SYS_stat:
                         return sys_stat((stat_args_t *)args);
 
@@ -299,6 +299,7 @@ ata_init()
 
                 sched_queue_init(&adisk->ata_waitq);
                 kmutex_init(&adisk->ata_mutex);
+                kmutex_setname(&adisk->ata_mutex, "ata_mutex");
 
                 dbg(DBG_DISK, "Initialized ATA device %d, channel %s, drive %s, size %d\n",
                     ii, (adisk->ata_channel ? "SECONDARY" : "PRIMARY"),
@@ -62,7 +62,9 @@ n_tty_destroy(tty_ldisc_t *ldisc)
 
 /*
  * Initialize the fields of the n_tty_t struct, allocate any memory
- * you will need later, and set the tty_ldisc field of the tty.
+ * you will need later, and set the tty_ldisc field of the tty. Name
+ * ntty_rlock "ntty_rlock" with kmutex_setname(), for the lock
+ * statistics.
  */
 void
 n_tty_attach(tty_ldisc_t *ldisc, tty_device_t *tty)
@@ -71,8 +73,8 @@ n_tty_attach(tty_ldisc_t *ldisc, tty_device_t *tty)
 }
 
 /*
- * Free any memory allocated in n_tty_attach and set the tty_ldisc
- * field of the tty.
+ * Free any memory allocated in n_tty_attach, kmutex_destroy()
+ * ntty_rlock and set the tty_ldisc field of the tty.
  */
 void
 n_tty_detach(tty_ldisc_t *ldisc, tty_device_t *tty)
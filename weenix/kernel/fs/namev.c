@@ -20,6 +20,10 @@
  *
  * If dir has no lookup(), return -ENOTDIR.
  *
+ * Don't lock dir here: the implementation's lookup() locks its
+ * vn_rwlock for reading, so that any number of lookups in the same
+ * directory can go on at once, and only wait for threads changing it.
+ *
  * Note: returns with the vnode refcount on *result incremented.
  */
 int
@@ -317,6 +317,25 @@ ramfs_umount(fs_t *fs)
         return 0;
 }
 
+/*
+ * Returns the entry of dir called name, or NULL if there is none. The
+ * caller holds dir's vn_rwlock.
+ */
+static ramfs_dirent_t *
+ramfs_find_dirent(vnode_t *dir, const char *name, size_t namelen)
+{
+        off_t i;
+        ramfs_dirent_t *entry = VNODE_TO_DIRENT(dir);
+
+        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
+                if (name_match(entry->rd_name, name, namelen)) {
+                        return entry;
+                }
+        }
+
+        return NULL;
+}
+
 static int
 ramfs_create(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
 {
@@ -324,7 +343,8 @@ ramfs_create(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
         off_t i;
         ramfs_dirent_t *entry;
 
-        KASSERT(0 != ramfs_lookup(dir, name, name_len, &vn));
+        krwlock_write_lock(&dir->vn_rwlock);
+        KASSERT(NULL == ramfs_find_dirent(dir, name, name_len));
 
         /* Look for space in the directory */
         entry = VNODE_TO_DIRENT(dir);
@@ -334,12 +354,14 @@ ramfs_create(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
         }
 
         if (i == RAMFS_MAX_DIRENT) {
+                krwlock_write_unlock(&dir->vn_rwlock);
                 return -ENOSPC;
         }
 
         /* Allocate an inode */
         int ino;
         if (0 > (ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_DATA, 0))) {
+                krwlock_write_unlock(&dir->vn_rwlock);
                 return ino;
         }
 
@@ -351,6 +373,7 @@ ramfs_create(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
         entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
 
         VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+        krwlock_write_unlock(&dir->vn_rwlock);
 
         *result = vn;
 
@@ -361,11 +384,11 @@ ramfs_create(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
 static int
 ramfs_mknod(struct vnode *dir, const char *name, size_t name_len, int mode, devid_t devid)
 {
-        vnode_t *vn;
         off_t i;
         ramfs_dirent_t *entry;
 
-        KASSERT(0 != ramfs_lookup(dir, name, name_len, &vn));
+        krwlock_write_lock(&dir->vn_rwlock);
+        KASSERT(NULL == ramfs_find_dirent(dir, name, name_len));
 
         /* Look for space in the directory */
         entry = VNODE_TO_DIRENT(dir);
@@ -375,21 +398,22 @@ ramfs_mknod(struct vnode *dir, const char *name, size_t name_len, int mode, devi
         }
 
         if (i == RAMFS_MAX_DIRENT) {
+                krwlock_write_unlock(&dir->vn_rwlock);
                 return -ENOSPC;
         }
 
         int ino;
         if (S_ISCHR(mode)) {
-                if (0 > (ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_CHR, devid))) {
-                        return ino;
-                }
+                ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_CHR, devid);
         } else if (S_ISBLK(mode)) {
-                if (0 > (ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_BLK, devid))) {
-                        return ino;
-                }
+                ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_BLK, devid);
         } else {
                 panic("Invalid mode!\n");
         }
+        if (0 > ino) {
+                krwlock_write_unlock(&dir->vn_rwlock);
+                return ino;
+        }
 
         /* Set entry in directory */
         entry->rd_ino = ino;
@@ -397,37 +421,42 @@ ramfs_mknod(struct vnode *dir, const char *name, size_t name_len, int mode, devi
         entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
 
         VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+        krwlock_write_unlock(&dir->vn_rwlock);
 
         return 0;
 }
 
+/*
+ * Directory operations which only read a directory hold its vn_rwlock
+ * for reading, so lookups in the same directory run alongside each
+ * other; the ones which change it hold the lock for writing.
+ */
 static int
 ramfs_lookup(vnode_t *dir, const char *name, size_t namelen, vnode_t **result)
 {
-        off_t i;
-        ramfs_inode_t *inode = VNODE_TO_RAMFSINODE(dir);
-        ramfs_dirent_t *entry = (ramfs_dirent_t *)inode->rf_mem;
+        ramfs_dirent_t *entry;
+        int ret = -ENOENT;
 
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (name_match(entry->rd_name, name, namelen)) {
-                        *result = vget(dir->vn_fs, entry->rd_ino);
-                        return 0;
-                }
+        krwlock_read_lock(&dir->vn_rwlock);
+        if (NULL != (entry = ramfs_find_dirent(dir, name, namelen))) {
+                *result = vget(dir->vn_fs, entry->rd_ino);
+                ret = 0;
         }
+        krwlock_read_unlock(&dir->vn_rwlock);
 
-        return -ENOENT;
+        return ret;
 }
 
 static int
 ramfs_link(vnode_t *oldvnode, vnode_t *dir,
            const char *name, size_t name_len)
 {
-        vnode_t *vn;
         off_t i;
         ramfs_dirent_t *entry;
 
         KASSERT(oldvnode->vn_fs == dir->vn_fs);
-        KASSERT(0 != ramfs_lookup(dir, name, name_len, &vn));
+        krwlock_write_lock(&dir->vn_rwlock);
+        KASSERT(NULL == ramfs_find_dirent(dir, name, name_len));
 
         /* Look for space in the directory */
         entry = VNODE_TO_DIRENT(dir);
@@ -437,6 +466,7 @@ ramfs_link(vnode_t *oldvnode, vnode_t *dir,
         }
 
         if (i == RAMFS_MAX_DIRENT) {
+                krwlock_write_unlock(&dir->vn_rwlock);
                 return -ENOSPC;
         }
 
@@ -446,6 +476,7 @@ ramfs_link(vnode_t *oldvnode, vnode_t *dir,
         entry->rd_name[MIN(name_len, NAME_LEN - 1)] = '\0';
 
         VNODE_TO_RAMFSINODE(dir)->rf_size += sizeof(ramfs_dirent_t);
+        krwlock_write_unlock(&dir->vn_rwlock);
 
         /* Increase linkcount */
         VNODE_TO_RAMFSINODE(oldvnode)->rf_linkcount++;
@@ -456,24 +487,18 @@ static int
 ramfs_unlink(vnode_t *dir, const char *name, size_t namelen)
 {
         vnode_t *vn;
-        int ret;
-        off_t i;
         ramfs_dirent_t *entry;
 
-        ret = ramfs_lookup(dir, name, namelen, &vn);
-        KASSERT(0 == ret);
+        krwlock_write_lock(&dir->vn_rwlock);
+        entry = ramfs_find_dirent(dir, name, namelen);
+        KASSERT(NULL != entry);
+        vn = vget(dir->vn_fs, entry->rd_ino);
         KASSERT(!S_ISDIR(vn->vn_mode));
 
         /* And then remove the entry from the directory */
-        entry = VNODE_TO_DIRENT(dir);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (name_match(entry->rd_name, name, namelen)) {
-                        entry->rd_name[0] = '\0';
-                        break;
-                }
-        }
-
+        entry->rd_name[0] = '\0';
         VNODE_TO_RAMFSINODE(dir)->rf_size -= sizeof(ramfs_dirent_t);
+        krwlock_write_unlock(&dir->vn_rwlock);
 
         VNODE_TO_RAMFSINODE(vn)->rf_linkcount--;
         vput(vn);
@@ -484,11 +509,11 @@ ramfs_unlink(vnode_t *dir, const char *name, size_t namelen)
 static int
 ramfs_mkdir(vnode_t *dir, const char *name, size_t name_len)
 {
-        vnode_t *vn;
         off_t i;
         ramfs_dirent_t *entry;
 
-        KASSERT(0 != ramfs_lookup(dir, name, name_len, &vn));
+        krwlock_write_lock(&dir->vn_rwlock);
+        KASSERT(NULL == ramfs_find_dirent(dir, name, name_len));
 
         /* Look for space in the directory */
         entry = VNODE_TO_DIRENT(dir);
@@ -498,12 +523,14 @@ ramfs_mkdir(vnode_t *dir, const char *name, size_t name_len)
         }
 
         if (i == RAMFS_MAX_DIRENT) {
+                krwlock_write_unlock(&dir->vn_rwlock);
                 return -ENOSPC;
         }
 
         /* Allocate an inode */
         int ino;
         if (0 > (ino = ramfs_alloc_inode(dir->vn_fs, RAMFS_TYPE_DIR, 0))) {
+                krwlock_write_unlock(&dir->vn_rwlock);
                 return ino;
         }
 
@@ -524,6 +551,7 @@ ramfs_mkdir(vnode_t *dir, const char *name, size_t name_len)
 
         /* Increase inode size accordingly */
         VNODE_TO_RAMFS(dir)->rfs_inodes[ino]->rf_size = 2 * sizeof(ramfs_dirent_t);
+        krwlock_write_unlock(&dir->vn_rwlock);
 
         return 0;
 }
@@ -532,17 +560,21 @@ static int
 ramfs_rmdir(vnode_t *dir, const char *name, size_t name_len)
 {
         vnode_t *vn;
-        int ret;
         off_t i;
-        ramfs_dirent_t *entry;
+        ramfs_dirent_t *dirent, *entry;
 
         KASSERT(!name_match(".", name, name_len) &&
                 !name_match("..", name, name_len));
 
-        if ((ret = ramfs_lookup(dir, name, name_len, &vn)) != 0)
-                return ret;
+        krwlock_write_lock(&dir->vn_rwlock);
+        if (NULL == (dirent = ramfs_find_dirent(dir, name, name_len))) {
+                krwlock_write_unlock(&dir->vn_rwlock);
+                return -ENOENT;
+        }
+        vn = vget(dir->vn_fs, dirent->rd_ino);
 
         if (!S_ISDIR(vn->vn_mode)) {
+                krwlock_write_unlock(&dir->vn_rwlock);
                 vput(vn);
                 return -ENOTDIR;
         }
@@ -555,20 +587,16 @@ ramfs_rmdir(vnode_t *dir, const char *name, size_t name_len)
                         continue;
 
                 if (entry->rd_name[0]) {
+                        krwlock_write_unlock(&dir->vn_rwlock);
                         vput(vn);
                         return -ENOTEMPTY;
                 }
         }
 
         /* Finally, remove the entry from the parent directory */
-        entry = VNODE_TO_DIRENT(dir);
-        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
-                if (name_match(entry->rd_name, name, name_len)) {
-                        entry->rd_name[0] = '\0';
-                        break;
-                }
-        }
+        dirent->rd_name[0] = '\0';
         VNODE_TO_RAMFSINODE(dir)->rf_size -= sizeof(ramfs_dirent_t);
+        krwlock_write_unlock(&dir->vn_rwlock);
 
         VNODE_TO_RAMFSINODE(vn)->rf_linkcount--;
         vput(vn);
@@ -617,6 +645,7 @@ ramfs_readdir(vnode_t *dir, off_t offset, struct dirent *d)
         KASSERT(S_ISDIR(dir->vn_mode));
         KASSERT(0 == offset % sizeof(ramfs_dirent_t));
 
+        krwlock_read_lock(&dir->vn_rwlock);
         dir_entry = VNODE_TO_DIRENT(dir);
         dir_entry = (ramfs_dirent_t *)(((char *)dir_entry) + offset);
         targ_entry = dir_entry;
@@ -626,15 +655,15 @@ ramfs_readdir(vnode_t *dir, off_t offset, struct dirent *d)
                 offset += sizeof(ramfs_dirent_t);
         }
 
-        if (offset >= (off_t)(RAMFS_MAX_DIRENT * sizeof(ramfs_dirent_t)))
-                return 0;
+        if (offset < (off_t)(RAMFS_MAX_DIRENT * sizeof(ramfs_dirent_t))) {
+                ret = sizeof(ramfs_dirent_t) + (targ_entry - dir_entry) * sizeof(ramfs_dirent_t);
 
-        ret = sizeof(ramfs_dirent_t) + (targ_entry - dir_entry) * sizeof(ramfs_dirent_t);
-
-        d->d_ino = targ_entry->rd_ino;
-        d->d_off = 0; /* unused */
-        strncpy(d->d_name, targ_entry->rd_name, NAME_LEN - 1);
-        d->d_name[NAME_LEN - 1] = '\0';
+                d->d_ino = targ_entry->rd_ino;
+                d->d_off = 0; /* unused */
+                strncpy(d->d_name, targ_entry->rd_name, NAME_LEN - 1);
+                d->d_name[NAME_LEN - 1] = '\0';
+        }
+        krwlock_read_unlock(&dir->vn_rwlock);
         return ret;
 }
 
@@ -160,6 +160,7 @@ s5fs_mount(struct fs *fs)
 
         /*     init s5f_mutex: */
         kmutex_init(&s5->s5f_mutex);
+        kmutex_setname(&s5->s5f_mutex, "s5f_mutex");
 
         /*     init s5f_fs: */
         s5->s5f_fs = fs;
@@ -278,6 +279,7 @@ s5fs_umount(fs_t *fs)
 
         pframe_unpin(sbp);
 
+        kmutex_destroy(&s5->s5f_mutex);
         kfree(s5);
 
         blockdev_flush_all(bd);
@@ -296,10 +298,14 @@ s5fs_umount(fs_t *fs)
  */
 
 /*
- * You will need to lock the vnode's mutex before doing anything that can block.
- * pframe functions can block, so probably what you want to do
- * is just lock the mutex in the s5fs_* functions listed below, and then not
- * worry about the mutexes in s5fs_subr.c.
+ * You will need to lock the vnode's vn_rwlock before doing anything that can
+ * block. pframe functions can block, so probably what you want to do
+ * is just lock it in the s5fs_* functions listed below, and then not
+ * worry about the locks in s5fs_subr.c.
+ *
+ * Lock it for reading in s5fs_read, s5fs_lookup, s5fs_readdir and s5fs_stat,
+ * which only look at the vnode, so that lookups in a busy directory do not
+ * wait for each other. Lock it for writing everywhere else.
  *
  * Note that you will not be calling pframe functions directly, but
  * s5fs_subr.c functions will be, so you need to lock around them.
@@ -377,7 +383,8 @@ s5fs_mknod(vnode_t *dir, const char *name, size_t namelen, int mode, devid_t dev
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
- * You probably want to use s5_find_dirent() and vget().
+ * You probably want to use s5_find_dirent() and vget(). Hold the
+ * directory's vn_rwlock for reading, not writing, across both.
  */
 int
 s5fs_lookup(vnode_t *base, const char *name, size_t namelen, vnode_t **result)
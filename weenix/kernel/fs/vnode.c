@@ -22,6 +22,10 @@
 static slab_allocator_t *vnode_allocator;
 
 static list_t vnode_inuse_list;
+/* Protects vnode_inuse_list. vget() mostly just looks vnodes up, so it
+ * can do so alongside other lookups. It is never held while blocking
+ * on anything else. */
+static krwlock_t vnode_table_lock;
 
 /* Related to vnodes representing special files: */
 static void init_special_vnode(vnode_t *vn);
@@ -94,6 +98,8 @@ static __attribute__((unused)) void
 vnode_init(void)
 {
         list_init(&vnode_inuse_list);
+        krwlock_init(&vnode_table_lock);
+        krwlock_setname(&vnode_table_lock, "vnode_table");
         vnode_allocator = slab_allocator_create("vnode", sizeof(vnode_t));
 }
 init_func(vnode_init);
@@ -111,6 +117,24 @@ vref(vnode_t *vn)
             vn, vn->vn_fs, (long)vn->vn_vno, vn->vn_refcount, vn->vn_nrespages);
 }
 
+/*
+ * Returns the in-use vnode 'vno' of 'fs', or NULL if there is none. The
+ * caller must hold vnode_table_lock.
+ */
+static vnode_t *
+vnode_find(struct fs *fs, ino_t vno)
+{
+        vnode_t *vn;
+
+        list_iterate_begin(&vnode_inuse_list, vn, vnode_t, vn_link) {
+                if ((vn->vn_fs == fs) && (vn->vn_vno == vno)) {
+                        return vn;
+                }
+        } list_iterate_end();
+
+        return NULL;
+}
+
 vnode_t *
 vget(struct fs *fs, ino_t vno)
 {
@@ -120,35 +144,35 @@ vget(struct fs *fs, ino_t vno)
 
         /* look for inuse vnode */
 find:
-        list_iterate_begin(&vnode_inuse_list, vn, vnode_t, vn_link) {
-                if ((vn->vn_fs == fs) && (vn->vn_vno == vno)) {
-                        /* found it... */
-                        if (VN_BUSY & vn->vn_flags) {
-                                /* it's either being brought in or it's on
-                                 * its way out. Let's not race whomever is
-                                 * doing this. */
-
-                                dbg(DBG_VNREF, "vget: wow, found vnode busy (0x%p, 0x%p ino %ld refcount %d)\n",
-                                    vn, vn->vn_fs, (long)vn->vn_vno, vn->vn_refcount);
-
-                                sched_sleep_on(&vn->vn_waitq);
-                                goto find;
-                        }
+        krwlock_read_lock(&vnode_table_lock);
+        if (NULL != (vn = vnode_find(fs, vno))) {
+                /* found it... */
+                if (VN_BUSY & vn->vn_flags) {
+                        /* it's either being brought in or it's on
+                         * its way out. Let's not race whomever is
+                         * doing this. */
+
+                        dbg(DBG_VNREF, "vget: wow, found vnode busy (0x%p, 0x%p ino %ld refcount %d)\n",
+                            vn, vn->vn_fs, (long)vn->vn_vno, vn->vn_refcount);
+
+                        krwlock_read_unlock(&vnode_table_lock);
+                        sched_sleep_on(&vn->vn_waitq);
+                        goto find;
+                }
 
-#ifndef __MOUNTING__
-                        /* If we are implementing mountpoint support
-                           then we should get the mounted vnode,
-                           not the requested one (if none is
-                           mounted then vn->vn_mount should
-                           point back to vn) */
-                        vref(vn);
-                        return vn;
-#else
-                        vref(vn->vn_mount);
-                        return vn->vn_mount;
+#ifdef __MOUNTING__
+                /* If we are implementing mountpoint support
+                   then we should get the mounted vnode,
+                   not the requested one (if none is
+                   mounted then vn->vn_mount should
+                   point back to vn) */
+                vn = vn->vn_mount;
 #endif
-                }
-        } list_iterate_end();
+                vref(vn);
+                krwlock_read_unlock(&vnode_table_lock);
+                return vn;
+        }
+        krwlock_read_unlock(&vnode_table_lock);
 
         /* if we got here, we didn't find the vnode. */
         /*   alloc a new vnode: */
@@ -165,7 +189,8 @@ find:
         /*     members that can be initialized here: */
         vn->vn_fs = fs;
         vn->vn_vno = vno;
-        kmutex_init(&vn->vn_mutex);
+        krwlock_init(&vn->vn_rwlock);
+        krwlock_setname(&vn->vn_rwlock, "vn_rwlock");
         mmobj_init(&vn->vn_mmobj, &vnode_mmobj_ops);
         sched_queue_init(&vn->vn_waitq);
 
@@ -183,8 +208,17 @@ find:
          *       outside this context (vnode.c) will exist until we are
          *       done bringing the vnode in)
          */
+        krwlock_write_lock(&vnode_table_lock);
+        if (NULL != vnode_find(fs, vno)) {
+                /* another thread brought it in while this one waited for
+                 * the lock */
+                krwlock_write_unlock(&vnode_table_lock);
+                slab_obj_free(vnode_allocator, vn);
+                goto find;
+        }
         vn->vn_flags |= VN_BUSY;
         list_insert_head(&vnode_inuse_list, &vn->vn_link);
+        krwlock_write_unlock(&vnode_table_lock);
 
         KASSERT(vn->vn_fs->fs_op && vn->vn_fs->fs_op->read_vnode);
         /*       this is where we might block (depending on the underlying
@@ -298,7 +332,10 @@ vput(struct vnode *vn)
          * we were taking it away: */
         sched_broadcast_on(&vn->vn_waitq);
 
+        krwlock_write_lock(&vnode_table_lock);
         list_remove(&vn->vn_link); /* remove from vn_inuse_list */
+        krwlock_write_unlock(&vnode_table_lock);
+        krwlock_destroy(&vn->vn_rwlock);
         slab_obj_free(vnode_allocator, vn);
 }
 
@@ -322,6 +359,7 @@ vfs_is_in_use(fs_t *fs)
         list_t *list = &vnode_inuse_list;
         list_link_t *link;
         int ret = 0;
+        krwlock_read_lock(&vnode_table_lock);
         for (link = list->l_next; link != list; link = link->l_next) {
                 vnode_t *vn = list_item(link, vnode_t, vn_link);
                 int refs;
@@ -352,11 +390,18 @@ vfs_is_in_use(fs_t *fs)
                         ret = -EBUSY;
                 }
         }
+        krwlock_read_unlock(&vnode_table_lock);
 
         return ret;
 }
 
 
+/*
+ * This does not take vnode_table_lock: cleaning pages blocks, and
+ * freeing them drops vnodes, which takes the lock for writing. The
+ * list is safe to walk as long as this does not block, and the walk
+ * starts over whenever it does.
+ */
 void
 vnode_flush_all(struct fs *fs)
 {
@@ -404,10 +449,12 @@ vnode_inuse(struct fs *fs)
         vnode_t *vn;
         int n = 0;
 
+        krwlock_read_lock(&vnode_table_lock);
         list_iterate_begin(&vnode_inuse_list, vn, vnode_t, vn_link) {
                 if (vn->vn_fs == fs)
                         n++;
         } list_iterate_end();
+        krwlock_read_unlock(&vnode_table_lock);
         return n;
 }
 
@@ -3,9 +3,13 @@
 #include "types.h"
 
 struct regs;
+struct spawn_file_action;
 
 int do_execve(const char *filename, char *const *argv, char *const *envp, struct regs *regs);
 
+int do_spawn(const char *filename, char *const *argv, char *const *envp,
+             const struct spawn_file_action *actions, int nactions);
+
 void kernel_execve(const char *filename, char *const *argv, char *const *envp);
 
 void userland_entry(const struct regs *regs);
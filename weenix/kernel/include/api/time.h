@@ -0,0 +1,51 @@
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+#ifdef __KERNEL__
+#include "types.h"
+#else
+#include "sys/types.h"
+#endif
+
+#define NSEC_PER_SEC    1000000000L
+
+typedef long time_t;
+typedef int clockid_t;
+
+/* Clocks for clock_gettime(). CLOCK_MONOTONIC counts from boot. */
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+        time_t  tv_sec;         /* seconds */
+        long    tv_nsec;        /* and nanoseconds, less than NSEC_PER_SEC */
+};
+
+/*
+ * The clock page, which the kernel maps read-only into every process at
+ * CLOCK_PAGE_ADDR, so that the time can be read without a system call.
+ * It holds how the processor's time stamp counter (rdtsc) was found to
+ * run against the PIT at boot. The nanoseconds since boot are
+ *
+ *     cp_ns + ((tsc - cp_tsc) * cp_mult) >> cp_shift
+ *
+ * worked out so that the product does not overflow. cp_mult is 0 until
+ * the clock has been calibrated. Nothing on it changes after that, so
+ * it can be read without any locking.
+ */
+#define CLOCK_PAGE_ADDR 0xffffa000
+
+struct clock_page {
+        uint64_t        cp_tsc;         /* the counter at boot */
+        uint64_t        cp_ns;          /* nanoseconds at cp_tsc */
+        uint32_t        cp_mult;        /* nanoseconds per count, */
+        uint32_t        cp_shift;       /* times 2^cp_shift */
+};
+
+/* Fills in 'tp' with the time on the given clock. */
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
+
+/* Sleeps for at least as long as 'req' says, rounded up to whole clock
+ * ticks. If the sleep is cut short, fills in 'rem' (if not NULL) with
+ * how long was left. */
+int nanosleep(const struct timespec *req, struct timespec *rem);
@@ -13,6 +13,19 @@
  */
 #define DEFAULT_STACK_SIZE      (56*1024) /* size of stacks */
 #define TICK_MSECS              10        /* msecs between clock interrupts */
+#define TICK_IDLE_MAX           1000      /* most ticks the clock is stopped for when
+                                           * there is nothing to run */
+
+/*
+ * Scheduler-related:
+ */
+#define SCHED_NICE_LEVELS       8         /* bands of run queue levels picked by nice(2) */
+#define SCHED_FEEDBACK_LEVELS   4         /* levels a thread can drop within its band */
+#define SCHED_SLICE_TICKS       1         /* ticks per slice at the top of a band, doubling
+                                           * with each level below it */
+#define SCHED_BOOST_TICKS       100       /* ticks between lifting every thread back to
+                                           * the top of its band */
+#define SMP_MAX_CPUS            8         /* processors brought up, any others stay halted */
 
 /*
  * Memory-management-related:
@@ -29,6 +42,14 @@
 /*         Pageout-related: */
 #define PAGEOUTD_FREE_TARGET_SHIFT     5 /* 3.125% */
 #define PAGEOUTD_FREE_MIN_SHIFT        4 /* 6.25% */
+/*         Shadow-object-related: */
+#define SHADOW_MAX_DEPTH               4 /* shadow objects in a chain before fork flattens it */
+/*         Page-table-related: */
+#define PT_PAGEDIR_CACHE_SIZE          8 /* page directories kept ready for new processes */
+/*         TLB-related: */
+#define TLB_FLUSH_ALL_PAGES           32 /* past this many pages, reload cr3 instead of invlpg */
+/*         madvise-related: */
+#define VM_READAHEAD_PAGES             8 /* pages read ahead of a MADV_SEQUENTIAL fault */
 
 
 /*
@@ -7,6 +7,33 @@
  * function. */
 void apic_init();
 
+/* Enables the local APIC of an application processor, which
+ * apic_init() leaves alone. Call on that processor. */
+void apic_initcpu();
+
+/* Returns the id of the local APIC of the processor running the
+ * caller. */
+uint8_t apic_getid();
+
+/* Fills in 'apicids' with the local APIC ids of up to 'max' of the
+ * enabled processors found in the ACPI tables, the boot processor's
+ * first, and returns how many there are. */
+int apic_getcpus(uint8_t *apicids, int max);
+
+/* Sends an INIT interprocessor interrupt to the processor with the
+ * given local APIC id, resetting it to wait for a startup IPI. */
+void apic_sendinit(uint8_t apicid);
+
+/* Sends a startup interprocessor interrupt to the processor with the
+ * given local APIC id, which starts it in real mode at 'paddr'. That
+ * must be a page aligned address in the first 1mb of memory. */
+void apic_sendstartup(uint8_t apicid, uintptr_t paddr);
+
+/* Raises interrupt 'intr' on the processor with the given local APIC
+ * id. Its handler must end with apic_eoi() like that of any other
+ * interrupt from the APIC. */
+void apic_sendipi(uint8_t apicid, uint8_t intr);
+
 /* Maps the given IRQ to the given interrupt number. */
 void apic_setredir(uint32_t irq, uint8_t intr);
 
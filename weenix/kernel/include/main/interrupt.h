@@ -16,6 +16,9 @@
 #define INTR_DISK_PRIMARY 0xd0
 #define INTR_DISK_SECONDARY 0xd1
 
+/* interprocessor interrupts, see main/smp.h */
+#define INTR_IPI_TLB 0xf3
+
 /* NOTE: INTR_SYSCALL is not defined here, but is in syscall.h (it must be
  * in a userland-accessible header) */
 
@@ -31,6 +34,10 @@ typedef struct regs {
 
 void intr_init();
 
+/* Loads the interrupt table set up by intr_init() on an application
+ * processor. Call on that processor. */
+void intr_initcpu();
+
 /* The function pointer which should be implemented by functions
  * which will handle interrupts. These handlers should be registered
  * with the interrupt subsystem via the intr_register function.
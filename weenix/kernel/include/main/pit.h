@@ -2,7 +2,7 @@
 
 #include "types.h"
 
-/* Starts the Programmable Interval Timer (PIT)
- * delivering periodic interrupts at 1000 Hz
- * (i.e., one every millisecond) to the given interrupt. */
-void pit_starttimer(uint8_t intr);
+/* Busy-waits for the given number of milliseconds (at most 50)
+ * by counting down PIT channel 2, which is not otherwise used.
+ * For calibrating other timers against. */
+void pit_delay(unsigned int msecs);
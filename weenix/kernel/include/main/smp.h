@@ -0,0 +1,47 @@
+#pragma once
+
+/* The page of low memory application processors start in, in real
+ * mode, out of the startup IPI. Nothing else uses it after the boot
+ * loader is done. */
+#define SMP_TRAMPOLINE 0x1000
+
+#ifndef __ASSEMBLY__
+
+#include "types.h"
+#include "config.h"
+
+/* A processor brought up by smp_init(). The boot processor is
+ * cpus[0]. */
+typedef struct cpu {
+        uint32_t          cpu_id;       /* index in cpus */
+        uint8_t           cpu_apicid;   /* id of its local APIC */
+        volatile int      cpu_online;   /* 1 once it is running */
+        volatile int      cpu_idle;     /* 1 while in its idle loop */
+        volatile uint32_t cpu_tlb_gen;  /* the smp_tlb_shootdown() its TLB
+                                         * has been flushed for */
+        char             *cpu_stack;    /* the stack of its idle loop */
+} cpu_t;
+
+extern cpu_t cpus[SMP_MAX_CPUS];
+extern uint32_t smp_ncpus;              /* processors running */
+
+/* Returns the processor running the caller. */
+cpu_t *cpu_self(void);
+
+/* Starts the other processors listed in the ACPI tables, each in its
+ * own idle loop on its own stack, GDT and TSS, if weenix is built with
+ * SMP (see Config.mk); otherwise only the boot processor runs. Must be
+ * called from kmain() after gdt_init(), while the first 4mb of memory
+ * are still identity mapped. */
+void smp_init(void);
+
+/* Raises interrupt 'intr' (one of the INTR_IPI_* interrupts) on the
+ * given processor. */
+void smp_ipi(cpu_t *cpu, uint8_t intr);
+
+/* Invalidates the TLB entries for the 'count' pages of kernel memory
+ * starting at 'vaddr' on every other processor, after the caller has
+ * changed their mappings and flushed its own TLB. */
+void smp_tlb_shootdown(uintptr_t vaddr, uint32_t count);
+
+#endif /* __ASSEMBLY__ */
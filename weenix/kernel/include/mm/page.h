@@ -20,7 +20,7 @@
 
 #define PAGE_ALIGNED(x) (0 == ((uintptr_t)(x)) % PAGE_SIZE)
 
-#define PAGE_NSIZES  8
+#define PAGE_NSIZES  11 /* blocks of up to 1024 pages, enough for a 4mb page */
 
 #define PAGE_SAME(addr1, addr2) (PAGE_ALIGN_DOWN(addr1) == PAGE_ALIGN_DOWN(addr2))
 
@@ -44,7 +44,7 @@ void  page_free(void *addr);
  * A call to page_alloc_n will allocate a block, to free
  * that block a call should be made to page_free_n with
  * npages set to the same as it was when the block was
- * allocated */
+ * allocated, or to page_free for each of its pages */
 void *page_alloc_n(uint32_t npages);
 void  page_free_n(void *start, uint32_t npages);
 
@@ -6,6 +6,8 @@
 #define PD_WRITE_THROUGH  0x008
 #define PD_CACHE_DISABLED 0x010
 #define PD_ACCESSED       0x020
+#define PD_SIZE           0x080 /* maps a 4mb page directly (needs CR4.PSE) */
+#define PD_GLOBAL         0x100 /* only meaningful along with PD_SIZE */
 
 #define PT_PRESENT        0x001
 #define PT_WRITE          0x002
@@ -17,16 +19,37 @@
 #define PT_SIZE           0x080
 #define PT_GLOBAL         0x100
 
+#define CR4_PSE           0x010 /* allow PD_SIZE entries */
+#define CR4_PGE           0x080 /* keep global entries in the TLB across cr3 loads */
+
+#define PT_LARGE_PAGES    1024  /* number of pages one PD_SIZE entry maps */
+
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
 
 typedef struct pagedir pagedir_t;
 
-/* Temporarily maps one page at the given physical address in at a
- * virtual address and returns that virtual address. Note that repeated
- * calls to this function will return the same virtual address, thereby
- * invalidating the previous mapping. */
-uintptr_t pt_phys_tmp_map(uintptr_t paddr);
+struct tlb_gather;
+
+/* The number of pages each thread can have mapped with pt_kmap at
+ * the same time. */
+#define PT_KMAP_SLOTS     4
+
+/* Maps the page at the given physical address into one of the running
+ * thread's kmap slots and returns its virtual address, which stays
+ * valid for that thread (even across context switches) until it is
+ * passed to pt_kunmap. This is how the kernel reaches physical memory
+ * outside its own mappings, such as the ACPI tables; while booting,
+ * before any thread runs, a set of slots of its own is used. Running
+ * out of slots is a bug and panics. Slots are flushed from the TLB
+ * lazily, when they are reused for a different page. */
+uintptr_t pt_kmap(uintptr_t paddr);
+void pt_kunmap(uintptr_t vaddr);
+
+/* Makes the given array of PT_KMAP_SLOTS physical addresses (0 for a
+ * free slot) the kmap slots in use, remapping any which differ from
+ * what is mapped now. Called when switching to a new thread. */
+void pt_kmap_load(uintptr_t *slots);
 
 /* Permenantly maps the given number of physical pages, starting at the
  * given physical address to a virtual address and returns that virtual
@@ -36,6 +59,13 @@ uintptr_t pt_phys_tmp_map(uintptr_t paddr);
  * will cause the kernel to panic. */
 uintptr_t pt_phys_perm_map(uintptr_t paddr, uint32_t count);
 
+/* Permanently maps the page at the given physical address read-only
+ * for user mode, at a fixed address in kernel memory which is the same
+ * in every page directory, and returns that address. There is only the
+ * one such page, for data the kernel publishes to every process (see
+ * CLOCK_PAGE_ADDR). */
+uintptr_t pt_phys_user_map(uintptr_t paddr);
+
 /* Looks up the given virtual address (vaddr) in the current page
  * directory, in order to find the matching physical memory address it
  * points to. vaddr MUST have a mapping in the current page directory,
@@ -54,25 +84,72 @@ int pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, ui
  * be page aligned. Note that the TLB is not flushed by this function. */
 void pt_unmap(pagedir_t *pd, uintptr_t vaddr);
 
+/* Returns whether user memory can be mapped with 4mb pages. */
+int pt_large_pages(void);
+
+/* Maps the 4mb of physical memory at paddr in at vaddr with a single
+ * page directory entry. Both must be 4mb aligned, and vaddr must be in
+ * the user address space with nothing mapped in its 4mb yet (an empty
+ * page table there is freed). pdflags should not include PD_SIZE.
+ * Returns 0 on success, -EBUSY if some page in the range is mapped.
+ *
+ * Every function here which changes part of such a mapping (pt_map,
+ * pt_unmap, pt_copy_range, and the unmap_range functions) first splits
+ * it into a page table of 4k mappings of the same pages. If there is
+ * no memory for the table, the whole 4mb is unmapped instead, and its
+ * pages fault back in one at a time. Note that the TLB is not flushed
+ * by this function. */
+int pt_map_large(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags);
+
 /* Unmaps the given range of addresses [low, high). As with pt_unmap,
- * the addresses must be page aligned in the user address space */
+ * the addresses must be page aligned in the user address space. Page
+ * tables left without any mappings are freed. */
 void pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh);
 
+/* Copies the mappings for the range of user addresses [vlow, vhigh)
+ * from src into dst, creating page tables in dst as needed. If cow is
+ * set the mappings are made read-only in both page directories, so
+ * that writes to them fault. Note that the TLB is not flushed by this
+ * function. Returns 0 on success and -ENOMEM if a page table could not
+ * be allocated, in which case only part of the range was copied. */
+int pt_copy_range(pagedir_t *dst, pagedir_t *src, uintptr_t vlow, uintptr_t vhigh, int cow);
+
+/* Like pt_unmap_range, but for the gather's page directory, recording
+ * the range in the gather and leaving any page tables it releases for
+ * tlb_gather_finish to free after the TLB has been flushed. */
+void pt_unmap_range_gather(struct tlb_gather *tg, uintptr_t vlow, uintptr_t vhigh);
+
 /* Creates a new page directory which is initialized to contain
  * mappings for all kernel memory. If there is not enough memory
  * to allocate the directory NULL is returned. Note that destroying
  * a page diretory does not affect the TLB, it is assumed that the
  * page directory being destroyed is not currently in use. Destroying
  * a page directory frees all page tables for user memory referenced
- * by that page directory. */
+ * by that page directory. Directories are recycled through a small
+ * cache, which the pagedird kernel process keeps filled. */
 pagedir_t *pt_create_pagedir();
 void pt_destroy_pagedir(pagedir_t *pdir);
 
 /* Sets the page table in cr3 and performs other updates required by
  * the page table subsystem. The address should be a virtual address,
  * it will be translated by the current page table before being
- * placed in cr3. */
+ * placed in cr3. Nothing is done if pd is already in cr3, and a page
+ * directory which has never been passed to pt_set_user only holds the
+ * kernel mappings every page directory shares, so the one in cr3 is
+ * kept (borrowed) instead. */
 void pt_set(pagedir_t *pd);
 
-/* Retreives the virtual address of the page directory currently in cr3. */
+/* Marks the page directory as used by a process running in user
+ * mode, so that pt_set always loads it from now on, and loads it if
+ * it is the one currently being borrowed. Must be called before
+ * entering user mode for the first time. */
+void pt_set_user(pagedir_t *pd);
+
+/* Returns the number of page tables mapping user memory in the given
+ * page directory, each of which takes up one page. 4mb mappings are
+ * counted as well, as they use up a page directory entry each. */
+uint32_t pt_user_tables(pagedir_t *pd);
+
+/* Retreives the virtual address of the page directory currently in cr3,
+ * which may be borrowed from another process (see pt_set). */
 pagedir_t *pt_get();
@@ -8,6 +8,7 @@
 #include "util/init.h"
 
 struct mmobj;
+struct tlb_gather;
 
 #define PF_BUSY                 0x01
 #define PF_DIRTY                0x02
@@ -53,17 +54,22 @@ void pframe_pageoutd_init(void);
 void pframe_shutdown(void);
 
 pframe_t *pframe_get_resident(struct mmobj *o, uint32_t pagenum);
+pframe_t *pframe_find_resident(struct mmobj *o, uint32_t pagenum);
 
 int pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result);
+pframe_t *pframe_adopt(struct mmobj *o, uint32_t pagenum, void *addr);
 int pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result);
 void pframe_migrate(pframe_t *pf, mmobj_t *dest);
 
+void pframe_deactivate(pframe_t *pf);
+
 void pframe_pin(pframe_t *pf);
 void pframe_unpin(pframe_t *pf);
 
 int  pframe_dirty(pframe_t *pf);
 int  pframe_clean(pframe_t *pf);
 void pframe_free(pframe_t *pf);
+void pframe_free_gather(struct tlb_gather *tg, pframe_t *pf);
 
 void pframe_clean_all(void);
 
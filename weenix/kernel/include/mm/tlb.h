@@ -4,6 +4,9 @@
 #include "types.h"
 
 #include "mm/page.h"
+#include "mm/pagetable.h"
+
+#include "main/smp.h"
 
 /* Invalidates any entries from the TLB which contain
  * mappings for the given virtual address. */
@@ -12,6 +15,15 @@ static inline void tlb_flush(uintptr_t vaddr)
         __asm__ volatile("invlpg (%0)" :: "r"(vaddr));
 }
 
+/* Invalidates the entries for the given address of kernel memory,
+ * whose mappings every processor shares, from the TLB of every
+ * processor. */
+static inline void tlb_flush_kernel(uintptr_t vaddr)
+{
+        tlb_flush(vaddr);
+        smp_tlb_shootdown(vaddr, 1);
+}
+
 /* Invalidates any entries for the count virtual addresses
  * starting at vaddr from the TLB. If this range is very
  * large it may be more efficient to call tlb_flush_all
@@ -24,10 +36,66 @@ static inline void tlb_flush_range(uintptr_t vaddr, uint32_t count)
         }
 }
 
-/* Invalidates the entire TLB. */
+/* Invalidates the entire TLB, except for global entries, i.e.
+ * the kernel's mappings. */
 static inline void tlb_flush_all()
 {
         uintptr_t pdir;
         __asm__ volatile("movl %%cr3, %0" : "=r"(pdir));
         __asm__ volatile("movl %0, %%cr3" :: "r"(pdir) : "memory");
 }
+
+/* Invalidates the entire TLB, including global entries. Needed
+ * after changing a kernel mapping which was not flushed
+ * page-by-page with tlb_flush. */
+static inline void tlb_flush_global()
+{
+        uint32_t cr4;
+        __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+        if (cr4 & CR4_PGE) {
+                __asm__ volatile("movl %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+                __asm__ volatile("movl %0, %%cr4" :: "r"(cr4) : "memory");
+        } else {
+                tlb_flush_all();
+        }
+}
+
+#define TLB_GATHER_FREE 16
+
+/* Collects the TLB invalidations needed after unmapping memory from a
+ * page directory so that tlb_gather_finish can do them all at once:
+ * one invlpg per page for a small range, a single cr3 reload once the
+ * range grows past TLB_FLUSH_ALL_PAGES pages, and nothing at all if the
+ * page directory is not loaded. Pages which may still be reached
+ * through stale TLB entries (such as page tables released by the
+ * unmap) are only freed after the flush. */
+typedef struct tlb_gather {
+        struct pagedir *tg_pd;        /* page directory being unmapped from */
+        uintptr_t       tg_start;     /* [lowest address unmapped, */
+        uintptr_t       tg_end;       /*  end of the highest range unmapped) */
+        uint32_t        tg_nfree;
+        void           *tg_free[TLB_GATHER_FREE]; /* pages to free after flushing */
+} tlb_gather_t;
+
+void tlb_gather_init(tlb_gather_t *tg, struct pagedir *pd);
+
+/* Records that [vlow, vhigh) has been unmapped from the gather's page
+ * directory. */
+void tlb_gather_range(tlb_gather_t *tg, uintptr_t vlow, uintptr_t vhigh);
+
+/* Records that the page at vaddr has been unmapped from the gather's
+ * page directory. */
+static inline void tlb_gather_page(tlb_gather_t *tg, uintptr_t vaddr)
+{
+        tlb_gather_range(tg, vaddr, vaddr + PAGE_SIZE);
+}
+
+/* Frees the given page (with page_free) once the TLB has been
+ * flushed. If too many pages are queued the flush happens early; the
+ * range recorded so far is kept and flushed again by
+ * tlb_gather_finish. */
+void tlb_gather_free(tlb_gather_t *tg, void *page);
+
+/* Does the invalidations collected so far and frees the queued pages.
+ * The gather may be used again afterwards. */
+void tlb_gather_finish(tlb_gather_t *tg);
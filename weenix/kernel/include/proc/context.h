@@ -19,6 +19,8 @@ typedef struct context {
 
         uintptr_t  c_kstack;
         size_t     c_kstacksz;
+
+        uintptr_t  c_kmap[PT_KMAP_SLOTS]; /* pages mapped with pt_kmap */
 } context_t;
 
 /**
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "types.h"
+
+/* Number of buckets of the futex hash table */
+#define FUTEX_HASH_SIZE         64
+
+/* Puts the current thread into a cancellable sleep on the futex at
+ * user address 'uaddr', as long as the int there still holds 'val'.
+ * Returns 0 once woken by do_futex_wake(), -EAGAIN if the int did not
+ * hold 'val', -EINTR if the sleep was cancelled, -EINVAL if 'uaddr' is
+ * not aligned and -EFAULT if it cannot be read. */
+int do_futex_wait(int *uaddr, int val);
+
+/* Wakes up to 'count' of the threads sleeping on the futex at user
+ * address 'uaddr', longest sleeping first. Returns how many were woken,
+ * or -EINVAL / -EFAULT as for do_futex_wait(). */
+int do_futex_wake(int *uaddr, int count);
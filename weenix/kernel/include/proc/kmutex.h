@@ -1,10 +1,38 @@
 #pragma once
 
+#include "types.h"
+
 #include "proc/sched.h"
 
+#ifdef __LOCKSTAT__
+#include "util/list.h"
+
+/* Contention statistics of a mutex, or of a krwlock_t. Times are in
+ * cycles of the time stamp counter. A lock is only listed for the
+ * lockstat kshell command once a thread has had to wait for it. */
+typedef struct kmutex_stat {
+        const void     *ks_lock;        /* the lock these are for */
+        const char     *ks_name;        /* set by kmutex_setname() */
+        uint32_t        ks_acquired;    /* times the mutex was taken */
+        uint32_t        ks_contended;   /* ...of which after waiting */
+        uint64_t        ks_wait_total;  /* time spent waiting for it */
+        uint64_t        ks_wait_max;
+        uint64_t        ks_hold_total;  /* time it was held */
+        uint64_t        ks_hold_max;
+        uint64_t        ks_held_since;  /* when the holder took it */
+        pid_t           ks_last_holder; /* process of the thread which held
+                                         * it when it was last waited for */
+        list_link_t     ks_link;        /* link on the list of contended
+                                         * locks */
+} kmutex_stat_t;
+#endif
+
 typedef struct kmutex {
         ktqueue_t       km_waitq;       /* wait queue */
         struct kthread *km_holder;      /* current holder */
+#ifdef __LOCKSTAT__
+        kmutex_stat_t   km_stat;
+#endif
 } kmutex_t;
 
 /**
@@ -14,6 +42,14 @@ typedef struct kmutex {
  */
 void kmutex_init(kmutex_t *mtx);
 
+/**
+ * Must be called on a mutex before the memory it is in is freed. The
+ * mutex must not be held, nor waited for.
+ *
+ * @param mtx the mutex
+ */
+void kmutex_destroy(kmutex_t *mtx);
+
 /**
  * Locks the specified mutex.
  *
@@ -40,8 +76,74 @@ void kmutex_lock(kmutex_t *mtx);
 int  kmutex_lock_cancellable(kmutex_t *mtx);
 
 /**
- * Unlocks the specified mutex.
+ * Unlocks the specified mutex. If there are threads waiting for it, it
+ * is handed straight to the one which has waited longest.
  *
  * @mtx the mutex to unlock
  */
 void kmutex_unlock(kmutex_t *mtx);
+
+/*
+ * Lock statistics, kept when weenix is built with LOCKSTAT. The
+ * kmutex functions call these, and without LOCKSTAT they do nothing.
+ */
+#ifdef __LOCKSTAT__
+/**
+ * Gives the mutex a name to list it under in the statistics. The
+ * name is not copied.
+ */
+void kmutex_setname(kmutex_t *mtx, const char *name);
+
+/**
+ * Clears the statistics of a mutex being initialized.
+ */
+void kmutex_stat_init(kmutex_t *mtx);
+
+/**
+ * Records that the current thread is about to wait for the mutex,
+ * which another thread holds.
+ *
+ * @return when the wait began, to pass to kmutex_stat_acquire()
+ */
+uint64_t kmutex_stat_wait(kmutex_t *mtx);
+
+/**
+ * Records that the current thread has just taken the mutex.
+ *
+ * @param since the value returned by kmutex_stat_wait() if the thread
+ * had to wait for the mutex, and 0 if it did not
+ */
+void kmutex_stat_acquire(kmutex_t *mtx, uint64_t since);
+
+/**
+ * Records that the current thread is about to give up the mutex.
+ */
+void kmutex_stat_release(kmutex_t *mtx);
+
+/**
+ * Copies the statistics of up to 'max' of the locks which have been
+ * waited for into 'stats', the most contended first.
+ *
+ * @return the number of locks copied
+ */
+int kmutex_stat_top(kmutex_stat_t *stats, int max);
+
+/*
+ * What the kmutex_stat functions do, on the statistics of any kind of
+ * lock, for locks other than mutexes (see krwlock_t). 'holder' is the
+ * thread holding the lock, or NULL if it is held by readers.
+ * lockstat_destroy() takes the statistics off the list of contended
+ * locks, before the lock is freed.
+ */
+void lockstat_init(kmutex_stat_t *ks, const void *lock);
+uint64_t lockstat_wait(kmutex_stat_t *ks, struct kthread *holder);
+void lockstat_acquire(kmutex_stat_t *ks, uint64_t since);
+void lockstat_release(kmutex_stat_t *ks);
+void lockstat_destroy(kmutex_stat_t *ks);
+#else
+static inline void kmutex_setname(kmutex_t *mtx, const char *name) { }
+static inline void kmutex_stat_init(kmutex_t *mtx) { }
+static inline uint64_t kmutex_stat_wait(kmutex_t *mtx) { return 0; }
+static inline void kmutex_stat_acquire(kmutex_t *mtx, uint64_t since) { }
+static inline void kmutex_stat_release(kmutex_t *mtx) { }
+#endif
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "proc/sched.h"
+#include "proc/kmutex.h"
+
+/*
+ * A lock which can be held by any number of readers at once, or by a
+ * single writer. Writers come first: once a writer is waiting, no new
+ * reader gets the lock until it has had it, so a steady stream of
+ * readers cannot keep writers out. A writer which unlocks hands the
+ * lock to the next waiting writer if there is one, and lets the
+ * waiting readers in if not.
+ *
+ * Like kmutex_t, these locks are not re-entrant, and are only ever
+ * locked and unlocked from thread context. A thread must not read lock
+ * a lock it already holds for reading either: a writer waiting between
+ * the two would deadlock with it.
+ */
+typedef struct krwlock {
+        ktqueue_t       krw_readq;      /* readers waiting */
+        ktqueue_t       krw_writeq;     /* writers waiting */
+        int             krw_readers;    /* readers holding the lock */
+        int             krw_wwaiting;   /* writers waiting for it */
+        struct kthread *krw_writer;     /* the writer holding it */
+#ifdef __LOCKSTAT__
+        kmutex_stat_t   krw_stat;       /* hold times are only kept for
+                                         * writers */
+#endif
+} krwlock_t;
+
+/**
+ * Initializes the fields of the specified krwlock_t.
+ *
+ * @param lock the lock to initialize
+ */
+void krwlock_init(krwlock_t *lock);
+
+/**
+ * Must be called on a lock before the memory it is in is freed. The
+ * lock must not be held, nor waited for.
+ *
+ * @param lock the lock
+ */
+void krwlock_destroy(krwlock_t *lock);
+
+/**
+ * Gives the lock a name to list it under in the lock statistics, as
+ * kmutex_setname() does for mutexes. The name is not copied.
+ *
+ * @param lock the lock
+ * @param name its name
+ */
+#ifdef __LOCKSTAT__
+void krwlock_setname(krwlock_t *lock, const char *name);
+#else
+static inline void krwlock_setname(krwlock_t *lock, const char *name) { }
+#endif
+
+/**
+ * Locks the specified lock for reading, shared with other readers.
+ *
+ * Note: This function may block.
+ *
+ * @param lock the lock to lock
+ */
+void krwlock_read_lock(krwlock_t *lock);
+
+/**
+ * Locks the specified lock for reading, but puts the current thread
+ * into a cancellable sleep if the function blocks.
+ *
+ * Note: This function may block.
+ *
+ * @param lock the lock to lock
+ * @return 0 if the current thread now holds the lock and -EINTR if the
+ * sleep was cancelled and this thread does not hold the lock
+ */
+int  krwlock_read_lock_cancellable(krwlock_t *lock);
+
+/**
+ * Unlocks the specified lock, which the current thread holds for
+ * reading.
+ *
+ * @param lock the lock to unlock
+ */
+void krwlock_read_unlock(krwlock_t *lock);
+
+/**
+ * Locks the specified lock for writing, excluding every other thread.
+ *
+ * Note: This function may block.
+ *
+ * @param lock the lock to lock
+ */
+void krwlock_write_lock(krwlock_t *lock);
+
+/**
+ * Locks the specified lock for writing, but puts the current thread
+ * into a cancellable sleep if the function blocks.
+ *
+ * Note: This function may block.
+ *
+ * @param lock the lock to lock
+ * @return 0 if the current thread now holds the lock and -EINTR if the
+ * sleep was cancelled and this thread does not hold the lock
+ */
+int  krwlock_write_lock_cancellable(krwlock_t *lock);
+
+/**
+ * Unlocks the specified lock, which the current thread holds for
+ * writing.
+ *
+ * @param lock the lock to unlock
+ */
+void krwlock_write_unlock(krwlock_t *lock);
@@ -22,9 +22,15 @@ typedef struct kthread {
 
         int             kt_cancelled;   /* 1 if this thread has been cancelled */
         ktqueue_t      *kt_wchan;       /* The queue that this thread is blocked on */
+        int             kt_exclusive;   /* 1 if it sleeps as an exclusive waiter */
+        int             kt_timedout;    /* 1 if its timed sleep ran out */
         int             kt_state;       /* this thread's state */
         list_link_t     kt_qlink;       /* link on ktqueue */
         list_link_t     kt_plink;       /* link on proc thread list */
+        int             kt_level;       /* run queue level, 0 runs first */
+        int             kt_ticks;       /* clock ticks run at that level */
+        int             kt_resched;     /* 1 if the slice has run out */
+        unsigned int    kt_npreempt;    /* times switched out by the clock */
 #ifdef __MTP__
         int             kt_detached;    /* if the thread has been detached */
         ktqueue_t       kt_joinq;       /* thread waiting to join with this thread */
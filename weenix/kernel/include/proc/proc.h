@@ -3,6 +3,7 @@
 #include "types.h"
 
 #include "proc/kthread.h"
+#include "proc/resource.h"
 
 #include "mm/pagetable.h"
 
@@ -13,6 +14,10 @@
 #define PROC_MAX_COUNT  65536
 #define PROC_NAME_LEN   256
 
+/* Range of nice(2) values; lower runs first */
+#define NICE_MIN        -20
+#define NICE_MAX        19
+
 struct regs;
 
 typedef struct proc {
@@ -42,6 +47,21 @@ typedef struct proc {
         struct vmmap   *p_vmmap;         /* list of areas mapped into
                                           * process' user address
                                           * space */
+
+        /* vfork(2): */
+        struct proc    *p_vfork_parent;  /* parent suspended until we exec
+                                          * or exit, or NULL */
+        struct vmmap   *p_vfork_vmmap;   /* our own vmmap and pagedir, set */
+        pagedir_t      *p_vfork_pagedir; /* aside while borrowing the
+                                          * parent's */
+        ktqueue_t       p_vfork_wait;    /* queue for the suspended parent */
+
+        struct rusage   p_rusage;        /* fault and paging counts; the
+                                          * rss members are unused */
+        struct rlimit   p_rlimit[RLIM_NLIMITS]; /* see setrlimit(2) */
+        int             p_nice;          /* scheduling niceness; see nice(2) */
+        uint32_t        p_rss_charged;   /* resident pages, counted high;
+                                          * see proc_charge_rss() */
 } proc_t;
 
 /* Process states. */
@@ -63,6 +83,15 @@ void proc_init(void);
  */
 proc_t *proc_create(char *name);
 
+/**
+ * Frees a process made by proc_create() which never got a thread,
+ * taking it off the process list and its parent's children. Any open
+ * files must already have been closed.
+ *
+ * @param p the process to free
+ */
+void proc_destroy(proc_t *p);
+
 /**
  * Finds the process with the specified PID.
  *
@@ -109,6 +138,15 @@ void proc_thread_exited(void *retval);
  */
 void do_exit(int status);
 
+/**
+ * Ends a vfork child's loan of its parent's address space: gives the
+ * process back its own vmmap and pagedir and wakes the parent. Does
+ * nothing if the process is not borrowing.
+ *
+ * @param p the process
+ */
+void proc_vfork_release(proc_t *p);
+
 /**
  * This function implements the waitpid(2) system call.
  *
@@ -128,6 +166,68 @@ pid_t do_waitpid(pid_t pid, int options, int *status);
  */
 int do_fork(struct regs *regs);
 
+/**
+ * This function implements the vfork(2) system call.
+ *
+ * @param regs the register state at the time of the system call
+ */
+int do_vfork(struct regs *regs);
+
+/**
+ * Fills in the memory usage of a process: its fault and paging counts,
+ * and the pages now resident under its vmmap.
+ *
+ * @param p the process
+ * @param ru used to return the usage
+ */
+void proc_rusage(proc_t *p, struct rusage *ru);
+
+/**
+ * Makes room under the RLIMIT_RSS limit of a process for npages more
+ * resident pages, which the caller is about to bring in for it. If the
+ * process could be over the limit its resident pages are counted, and
+ * if need be its own unpinned pages are reclaimed (see vmmap_reclaim()).
+ * Other processes are never asked to give up memory.
+ *
+ * @param p the process
+ * @param npages the number of pages about to be made resident
+ * @return 0 on success, or -ENOMEM if the process would still be over
+ * its limit
+ */
+int proc_charge_rss(proc_t *p, uint32_t npages);
+
+/**
+ * These functions implement the getrlimit(2) and setrlimit(2) system
+ * calls. Only the RLIMIT_RSS resource is supported. A limit may be
+ * lowered freely; rlim_max may not be raised.
+ *
+ * @return 0 on success, -EINVAL for an unknown resource or if rlim_cur
+ * is above rlim_max, or -EPERM when raising rlim_max
+ */
+int do_getrlimit(int resource, struct rlimit *rlim);
+int do_setrlimit(int resource, const struct rlimit *rlim);
+
+/**
+ * This function implements the nice(2) system call: adds incr to the
+ * nice value of the current process, keeping it within NICE_MIN and
+ * NICE_MAX. Its threads move to the new band of run queue levels the
+ * next time they are put on the run queue.
+ *
+ * @param incr the amount to add
+ * @return the new nice value
+ */
+int do_nice(int incr);
+
+/**
+ * This function implements the getrusage(2) system call.
+ *
+ * @param who RUSAGE_SELF, or the pid of the process to report on
+ * @param ru used to return the usage
+ * @return 0 on success, -ESRCH if there is no such process, or -EINVAL
+ * if who is negative
+ */
+int do_getrusage(int who, struct rusage *ru);
+
 /**
  * Provides detailed debug information about a given process.
  *
@@ -0,0 +1,39 @@
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+/* Who getrusage() reports on. Any positive value is taken to be the
+ * pid of the process to report on instead.
+*/
+#define RUSAGE_SELF     0
+
+/* Resource limits; see setrlimit(). RLIMIT_RSS limits the resident
+ * memory of a process, in bytes. A process over it reclaims its own
+ * pages, and if it cannot it is refused more memory.
+*/
+#define RLIMIT_RSS      0
+#define RLIM_NLIMITS    1
+
+typedef unsigned long rlim_t;
+
+#define RLIM_INFINITY   ((rlim_t)-1)
+
+struct rlimit {
+        rlim_t rlim_cur;             /* limit in force */
+        rlim_t rlim_max;             /* most rlim_cur may be raised to */
+};
+
+/* Memory usage of a process. The rss counts are in pages and are
+ * worked out when asked for; pages shared with other processes are
+ * counted in full by each of them. The rest count events over the life
+ * of the process.
+*/
+struct rusage {
+        unsigned long ru_anonrss;    /* resident anonymous pages */
+        unsigned long ru_shadowrss;  /* resident private (copy-on-write) pages */
+        unsigned long ru_filerss;    /* resident pages of mapped files */
+        unsigned long ru_minflt;     /* page faults needing no I/O */
+        unsigned long ru_majflt;     /* page faults which read a page in */
+        unsigned long ru_pageins;    /* pages read in by the process */
+        unsigned long ru_pageouts;   /* its pages written back by pageoutd */
+};
@@ -6,6 +6,8 @@ struct kthread;
 typedef struct ktqueue {
         list_t          tq_list;
         int             tq_size;
+        unsigned int    tq_nspurious;   /* wakeups after which the thread
+                                         * had to go back to sleep */
 } ktqueue_t;
 
 /**
@@ -20,6 +22,42 @@ void sched_switch(void);
  */
 void sched_make_runnable(struct kthread *kt);
 
+/**
+ * Moves a thread which is being woken from a sleep up a level of the
+ * run queue, within the band of levels its process's nice value
+ * allows, and gives it a fresh slice. Call before making it runnable.
+ *
+ * @param thr the thread being woken
+ */
+void sched_boost(struct kthread *thr);
+
+/**
+ * Charges a clock tick to the current thread. When the thread has used
+ * up its slice it is moved down a level (so its next slice is twice as
+ * long) and 1 is returned: it should then give up the processor.
+ * Every SCHED_BOOST_TICKS ticks all threads go back to the top of
+ * their band. Called from the clock interrupt, with interrupts
+ * blocked.
+ *
+ * @return 1 if the current thread's slice has run out, 0 otherwise
+ */
+int sched_tick(void);
+
+/**
+ * Puts the current thread, whose slice has run out, back on the run
+ * queue and switches to the next thread. Must only be called where the
+ * current thread holds nothing other threads might need: on the way
+ * back to userland, or from sched_cond_resched().
+ */
+void sched_preempt(void);
+
+/**
+ * Calls sched_preempt() if the current thread's slice has run out. Long
+ * running kernel threads call this at points where they can safely be
+ * switched out, since the clock only preempts threads in userland.
+ */
+void sched_cond_resched(void);
+
 /**
  * Initializes a queue.
  *
@@ -52,6 +90,61 @@ void sched_sleep_on(ktqueue_t *q);
  */
 int sched_cancellable_sleep_on(ktqueue_t *q);
 
+/**
+ * Like sched_sleep_on(), but the thread sleeps as an exclusive waiter:
+ * sched_broadcast_on() wakes just one of the exclusive waiters on a
+ * queue, the one which has waited longest, rather than all of them.
+ * For queues where only one of the threads woken could make progress
+ * anyway. Once the woken thread is done with what it waited for, it
+ * must pass the wakeup on with sched_wakeup_on(), whether or not it
+ * got anywhere, or the others may never wake.
+ *
+ * @param q the queue to sleep on
+ */
+void sched_sleep_on_exclusive(ktqueue_t *q);
+
+/**
+ * The cancellable version of sched_sleep_on_exclusive(). A thread can
+ * be cancelled after a wakeup has picked it, and then gives up on what
+ * it waited for, so when the sleep is cancelled another thread is woken
+ * from the queue in its place. That wakeup may well be spurious for the
+ * thread it wakes, which has to check that it can make progress.
+ *
+ * @param q the queue to sleep on
+ * @return -EINTR if the thread was cancelled and 0 otherwise
+ */
+int sched_cancellable_sleep_on_exclusive(ktqueue_t *q);
+
+/**
+ * Like sched_sleep_on(), but the thread is also woken once 'ticks'
+ * clock ticks have passed, by a timer taken off the wheel again before
+ * this returns.
+ *
+ * @param q the queue to sleep on
+ * @param ticks how long to sleep for at most, at least one tick
+ * @return -ETIMEDOUT if the time ran out and 0 otherwise
+ */
+int sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks);
+
+/**
+ * The cancellable version of sched_sleep_on_timeout().
+ *
+ * @param q the queue to sleep on
+ * @param ticks how long to sleep for at most, at least one tick
+ * @return -EINTR if the thread was cancelled, -ETIMEDOUT if the time
+ * ran out and 0 otherwise
+ */
+int sched_cancellable_sleep_on_timeout(ktqueue_t *q, uint32_t ticks);
+
+/**
+ * Records that a thread woken from the queue could not make progress
+ * and is about to sleep on it again. The running count is logged with
+ * dbg(DBG_SCHED).
+ *
+ * @param q the queue
+ */
+void sched_queue_spurious(ktqueue_t *q);
+
 /**
  * Wakes a single thread from sleep if there are any waiting on the
  * queue.
@@ -62,7 +155,8 @@ int sched_cancellable_sleep_on(ktqueue_t *q);
 struct kthread *sched_wakeup_on(ktqueue_t *q);
 
 /**
- * Wake up all threads running on the queue.
+ * Wake up all threads sleeping on the queue, except that only the
+ * first of its exclusive waiters is woken.
  *
  * @param q the queue to wake up threads from
  */
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "types.h"
+
+/* A lock for data shared between processors, which busy-waits instead
+ * of sleeping. It does nothing about interrupts: data an interrupt
+ * handler takes the lock for must only be locked elsewhere with
+ * interrupts blocked, or the handler may spin on a lock held by the
+ * code it interrupted. Hold spinlocks briefly and never block while
+ * holding one. */
+typedef struct spinlock {
+        volatile uint32_t sl_locked;    /* 1 if held */
+} spinlock_t;
+
+static inline void
+spinlock_init(spinlock_t *lock)
+{
+        lock->sl_locked = 0;
+}
+
+/* Takes the lock if it is free. Returns 1 if it was taken and 0 if
+ * not. */
+static inline int
+spinlock_trylock(spinlock_t *lock)
+{
+        uint32_t old = 1;
+        __asm__ volatile("xchgl %0, %1"
+                         : "+r"(old), "+m"(lock->sl_locked) :: "memory");
+        return 0 == old;
+}
+
+/* Spins until the lock is free, then takes it. */
+static inline void
+spinlock_lock(spinlock_t *lock)
+{
+        while (!spinlock_trylock(lock)) {
+                /* wait without the locked bus cycles of xchg */
+                while (lock->sl_locked) {
+                        __asm__ volatile("pause" ::: "memory");
+                }
+        }
+}
+
+static inline void
+spinlock_unlock(spinlock_t *lock)
+{
+        /* stores are not reordered with earlier loads or stores on x86,
+         * so keeping the compiler from moving them is enough */
+        __asm__ volatile("" ::: "memory");
+        lock->sl_locked = 0;
+}
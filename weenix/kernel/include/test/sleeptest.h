@@ -0,0 +1,10 @@
+#pragma once
+
+#include "test/kshell/kshell.h"
+
+/*
+ * Cancels kernel threads asleep in do_nanosleep(), both while the sleep
+ * has time left and after its timer has run out but before the thread
+ * got to run again. Results are reported with dbg(DBG_TEST, ...).
+ */
+int sleeptest_main(kshell_t *ksh, int argc, char **argv);
@@ -11,6 +11,16 @@ bit_flip(void *addr, uintptr_t bit)
         *map ^= (uint32_t)(1 << (bit & 0x1f));
 }
 
+/* Returns the index of the lowest bit set in word, which must not be
+ * 0. */
+static inline int
+bit_first_set(uint32_t word)
+{
+        int bit;
+        __asm__("bsfl %1, %0" : "=r"(bit) : "rm"(word));
+        return bit;
+}
+
 static inline int
 bit_check(const void *addr, uintptr_t bit)
 {
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "types.h"
+
+struct timespec;
+
+/* Returns the processor's time stamp counter, which counts cycles
+ * since it was reset. */
+static inline uint64_t
+rdtsc(void)
+{
+        uint64_t tsc;
+        __asm__ volatile("rdtsc" : "=A"(tsc));
+        return tsc;
+}
+
+/* Returns the number of clock ticks (of TICK_MSECS each) since boot. */
+uint32_t time_ticks(void);
+
+/* Returns the nanoseconds since the clock was calibrated at boot, read
+ * from the time stamp counter, or 0 before then. The same clock user
+ * processes read off the clock page (see api/time.h). */
+uint64_t ktime_ns(void);
+
+/* Called by the scheduler, with interrupts disabled, just before it
+ * waits for an interrupt because nothing is runnable. Stops the
+ * periodic clock and sets it to go off once, at the next time anything
+ * is due (but at most TICK_IDLE_MAX ticks away). */
+void time_idle_enter(void);
+
+/* Called by the scheduler once the interrupt it waited for has come.
+ * Catches the tick count up with the time spent idle and restarts the
+ * periodic clock. */
+void time_idle_exit(void);
+
+/* Puts the current thread into a cancellable sleep for at least as long
+ * as 'req' says, rounded up to whole clock ticks. Returns 0 once the
+ * time is up, -EINVAL if 'req' is not a valid time, and -EINTR if the
+ * sleep was cancelled, in which case 'rem' (if not NULL) is filled in
+ * with how long was left. */
+int do_nanosleep(const struct timespec *req, struct timespec *rem);
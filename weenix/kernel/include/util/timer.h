@@ -0,0 +1,55 @@
+#pragma once
+
+#include "types.h"
+
+#include "util/list.h"
+
+/*
+ * Kernel timers, which call a function once a number of clock ticks
+ * have passed. Pending timers are kept in a hierarchical timing wheel:
+ * TIMER_LEVELS wheels of TIMER_SLOTS slots each, where a slot of the
+ * first wheel holds the timers due at one tick, a slot of the second
+ * those due within one turn of the first, and so on. Arming and
+ * cancelling a timer only add it to or take it off the list of a slot.
+ * Each time the first wheel comes round, the next slot of the second
+ * is spread out over it, and likewise up the levels.
+ */
+#define TIMER_SLOT_BITS         6
+#define TIMER_SLOTS             (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS            4
+
+/* Timers further off than this many ticks go in the last slot the
+ * wheels reach, and are moved on from there when it comes round. */
+#define TIMER_MAX_TICKS         ((1 << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1)
+
+typedef struct ktimer {
+        uint32_t        tm_expires;             /* tick it is due at */
+        void          (*tm_func)(void *arg);    /* called when it goes off */
+        void           *tm_arg;
+        list_link_t     tm_link;                /* link on its wheel slot */
+} ktimer_t;
+
+/* Sets up a timer which is not armed. */
+void ktimer_init(ktimer_t *timer, void (*func)(void *arg), void *arg);
+
+/* Arms the timer to go off 'ticks' ticks from now (at least one),
+ * first cancelling it if it is already armed. The function is called
+ * from the clock interrupt, with interrupts blocked, so it must not
+ * block; waking threads up is all right. */
+void ktimer_arm(ktimer_t *timer, uint32_t ticks);
+
+/* Disarms the timer. Returns 1 if it was armed and 0 if it had already
+ * gone off (or was never armed). */
+int ktimer_cancel(ktimer_t *timer);
+
+/* Returns 1 if the timer is armed. */
+int ktimer_armed(ktimer_t *timer);
+
+/* Called by the clock with interrupts blocked: runs every timer due up
+ * to tick 'now'. */
+void ktimer_run(uint32_t now);
+
+/* Returns how many ticks the clock can go without calling ktimer_run()
+ * before a timer is due, at most 'max'. Used to decide how long to
+ * stop the clock for while idle. */
+uint32_t ktimer_next(uint32_t max);
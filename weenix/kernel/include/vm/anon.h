@@ -4,6 +4,7 @@ struct mmobj;
 
 void anon_init();
 struct mmobj *anon_create(void);
+int mmobj_is_anon(struct mmobj *o);
 
 extern int anon_count;
 
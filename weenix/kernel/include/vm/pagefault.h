@@ -8,4 +8,8 @@
 #define FAULT_RESERVED 0x08
 #define FAULT_EXEC     0x10
 
+struct vmarea;
+
 void handle_pagefault(uintptr_t vaddr, uint32_t cause);
+void pagefault_apply_advice(uintptr_t vaddr);
+int vmarea_fault_huge(struct vmarea *vma, uint32_t vfn);
@@ -5,5 +5,9 @@ struct mmobj;
 void shadow_init();
 struct mmobj *shadow_create(void);
 
+int shadow_collapse(struct mmobj *top);
+int shadow_limit_depth(struct mmobj *top);
+void shadow_collapse_siblings(struct mmobj *bottom);
+
 extern int shadow_count;
 
@@ -1,4 +1,11 @@
 #pragma once
 
 void shadowd_wakeup(void);
-void shadowd_alloc_sleep(void);
+
+/* Sleeps until shadowd has had a go at freeing memory. Threads waiting
+ * for memory sleep as exclusive waiters, so shadowd only wakes one of
+ * them, which must call shadowd_alloc_done() once it has tried to
+ * allocate again to wake the next. 'again' is nonzero if the thread was
+ * woken from here already and is going back to sleep. */
+void shadowd_alloc_sleep(int again);
+void shadowd_alloc_done(void);
@@ -8,7 +8,9 @@
 #define VMMAP_DIR_HILO 2
 
 struct mmobj;
+struct pagedir;
 struct proc;
+struct rusage;
 struct vnode;
 
 typedef struct vmmap {
@@ -24,10 +26,14 @@ typedef struct vmarea {
         uint32_t       vma_off;      /* offset from beginning of vma_obj in pages */
 
         int            vma_prot;     /* permissions on mapping */
-        int            vma_flags;    /* either MAP_SHARED or MAP_PRIVATE */
+        int            vma_flags;    /* either MAP_SHARED or MAP_PRIVATE,
+                                      * plus MAP_HUGE if asked for and
+                                      * MAP_LOCKED if mlock(2)ed */
+        int            vma_advice;   /* MADV_* hint set by madvise(2) */
 
         struct vmmap  *vma_vmmap;    /* address space that this area belongs to */
         struct mmobj  *vma_obj;      /* the vm object to read pages from */
+        struct mmobj  *vma_lockobj;  /* vma_obj when the area was locked */
         list_link_t    vma_plink;    /* link on process vmmap maps list */
         list_link_t    vma_olink;    /* link on the list of all vm_areas
                                       * having the same vm_object at the
@@ -49,5 +55,14 @@ int vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count);
 int vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count);
 
 vmmap_t *vmmap_clone(vmmap_t *map);
+int vmmap_clone_ptes(vmmap_t *map, struct pagedir *from, struct pagedir *to);
+void vmmap_collapse(vmmap_t *map);
+void vmmap_rss(vmmap_t *map, struct rusage *ru);
+uint32_t vmmap_reclaim(vmmap_t *map, uint32_t npages);
+
+int vmarea_page_resident(vmarea_t *vma, uint32_t pagenum, int forwrite);
+int vmarea_populate(vmarea_t *vma, uint32_t lopage, uint32_t hipage, int lock);
+void vmarea_unlock(vmarea_t *vma, uint32_t lopage, uint32_t hipage);
+void vmarea_put_obj(vmarea_t *vma);
 
 size_t vmmap_mapping_info(const void *map, char *buf, size_t size);
@@ -1,4 +1,5 @@
 #include "types.h"
+#include "kernel.h"
 
 #include "main/acpi.h"
 
@@ -79,19 +80,34 @@ static void *__rsdp_search()
 static struct rsdp *rsd_ptr;
 static struct rsd_table *rsd_table;
 
+/* copies count bytes of physical memory starting at paddr to buf, one
+ * page at a time through a kmap slot */
+static void _acpi_copy_phys(void *buf, uintptr_t paddr, size_t count)
+{
+        while (count > 0) {
+                size_t n = MIN(count, PAGE_SIZE - PAGE_OFFSET(paddr));
+                uintptr_t vaddr = pt_kmap((uintptr_t)PAGE_ALIGN_DOWN(paddr));
+                memcpy(buf, (void *)(vaddr + PAGE_OFFSET(paddr)), n);
+                pt_kunmap(vaddr);
+
+                buf = (char *)buf + n;
+                paddr += n;
+                count -= n;
+        }
+}
+
 /* given the physical address of an ACPI table this function
  * allocates memory for that table and copies the table into
  * that memory, returning the new virtual address for that table */
 static void *_acpi_load_table(uintptr_t paddr)
 {
-        struct acpi_header *tmp =
-                (struct acpi_header *)(pt_phys_tmp_map((uintptr_t)PAGE_ALIGN_DOWN(paddr)) + (PAGE_OFFSET(paddr)));
-
-        /* this function is not designed to handle tables which
-         * cross page boundaries */
-        KASSERT(PAGE_OFFSET(paddr) + tmp->ah_size < PAGE_SIZE);
-        struct acpi_header *table = kmalloc(tmp->ah_size);
-        memcpy(table, tmp, tmp->ah_size);
+        struct acpi_header header;
+
+        _acpi_copy_phys(&header, paddr, sizeof(header));
+        KASSERT(sizeof(header) <= header.ah_size);
+        struct acpi_header *table = kmalloc(header.ah_size);
+        KASSERT(NULL != table);
+        _acpi_copy_phys(table, paddr, header.ah_size);
         return (void *)table;
 }
 
@@ -103,7 +119,7 @@ void acpi_init()
         KASSERT(NULL != rsd_ptr && "Could not find the ACPI Root Descriptor Table.");
 
         /* use the RSDP to find the RSDT, which will probably be in unmapped physical
-         * memory, therefore we must use the phys_tmp_map functionallity of page tables */
+         * memory, therefore we must use the kmap functionallity of page tables */
         rsd_table = _acpi_load_table(rsd_ptr->rp_addr);
         KASSERT(RSDT_SIGNATURE == rsd_table->rt_header.ah_sign);
         KASSERT(0 == __acpi_checksum((void *)rsd_table, rsd_table->rt_header.ah_size));
@@ -1,4 +1,5 @@
 #include "types.h"
+#include "config.h"
 
 #include "main/io.h"
 #include "main/acpi.h"
@@ -30,12 +31,22 @@
 #define LAPICSPUR (*(volatile uint32_t*)(apic->at_addr + 0xf0))
 #define LAPICTPR (*(volatile uint32_t*)(apic->at_addr + 0x80))
 #define LAPICERR (*(volatile uint32_t*)(apic->at_addr + 0x280))
+#define LAPICICRLO (*(volatile uint32_t*)(apic->at_addr + 0x300))
+#define LAPICICRHI (*(volatile uint32_t*)(apic->at_addr + 0x310))
 
 #define LAPICTIMER (*(volatile uint32_t*)(apic->at_addr + 0x320))
 #define LAPICINITCNT (*(volatile uint32_t*)(apic->at_addr + 0x380))
 #define LAPICCURCNT (*(volatile uint32_t*)(apic->at_addr + 0x390))
 #define LAPICDIVCONF (*(volatile uint32_t*)(apic->at_addr + 0x3e0))
 
+/* Interprocessor interrupt delivery modes, and the bits of the low
+ * interrupt command register */
+#define ICR_FIXED (0x0 << 8)
+#define ICR_INIT (0x5 << 8)
+#define ICR_STARTUP (0x6 << 8)
+#define ICR_PENDING (1 << 12)
+#define ICR_ASSERT (1 << 14)
+
 #define BIT_SET(data,bit) do { (data) = ((data)|(0x1<<(bit))); } while(0);
 #define BIT_UNSET(data,bit) do { (data) = ((data)&~(0x1<<(bit))); } while(0);
 
@@ -64,6 +75,10 @@ struct ioapic_table {
 
 static struct apic_table *apic = NULL;
 static struct lapic_table *lapic = NULL;
+/* the local APICs of the enabled processors, the boot processor's
+ * (lapic) first */
+static struct lapic_table *lapics[SMP_MAX_CPUS];
+static int nlapics = 0;
 static struct ioapic_table *ioapic = NULL;
 
 static uint32_t __ioapic_getid(void)
@@ -160,23 +175,36 @@ void apic_init()
         KASSERT(PAGE_ALIGNED(apic->at_addr));
         apic->at_addr = pt_phys_perm_map(apic->at_addr, 1);
 
-        /* Get the tables for the local APIC and IO APICS,
-         * Weenix currently only supports one of each, in order
-         * to enforce this a KASSERT will fail this if more than one
-         * of each type is found */
+        /* Get the tables for the local APICs and IO APICS. There is a
+         * local APIC for each processor, the one this code reads its
+         * registers through belonging to the boot processor. Weenix
+         * currently only supports one IO APIC, in order to enforce
+         * this a KASSERT will fail this if more than one is found */
         uint8_t off = sizeof(*apic);
         while (off < apic->at_header.ah_size) {
                 uint8_t type = *(ptr + off);
                 uint8_t size = *(ptr + off + 1);
                 if (TYPE_LAPIC == type) {
                         KASSERT(sizeof(struct lapic_table) == size);
-                        KASSERT(NULL == lapic && "Weenix only supports a single local APIC");
-                        lapic = (struct lapic_table *)(ptr + off);
+                        struct lapic_table *table = (struct lapic_table *)(ptr + off);
                         dbgq(DBG_CORE, "LAPIC:\n");
-                        dbgq(DBG_CORE, "   id:         0x%.2x\n", (uint32_t)lapic->at_apicid);
-                        dbgq(DBG_CORE, "   processor:  0x%.3x\n", (uint32_t)lapic->at_procid);
-                        dbgq(DBG_CORE, "   enabled:    %i\n", lapic->at_flags & 0x1);
-                        KASSERT(lapic->at_flags & 0x1 && "The local APIC is disabled");
+                        dbgq(DBG_CORE, "   id:         0x%.2x\n", (uint32_t)table->at_apicid);
+                        dbgq(DBG_CORE, "   processor:  0x%.3x\n", (uint32_t)table->at_procid);
+                        dbgq(DBG_CORE, "   enabled:    %i\n", table->at_flags & 0x1);
+                        if (table->at_apicid == __lapic_getid()) {
+                                KASSERT(NULL == lapic);
+                                KASSERT(table->at_flags & 0x1 && "The local APIC is disabled");
+                                lapic = table;
+                                lapics[nlapics++] = lapics[0];
+                                lapics[0] = lapic;
+                        } else if (!(table->at_flags & 0x1)) {
+                                dbgq(DBG_CORE, "   (processor disabled, not used)\n");
+                        } else if (nlapics + (NULL == lapic) < SMP_MAX_CPUS) {
+                                /* leaving room for the boot processor */
+                                lapics[nlapics++] = table;
+                        } else {
+                                dbgq(DBG_CORE, "   (more than %d processors, not used)\n", SMP_MAX_CPUS);
+                        }
                 } else if (TYPE_IOAPIC == type) {
                         KASSERT(sizeof(struct ioapic_table) == size);
                         KASSERT(NULL == ioapic && "Weenix only supports a single IO APIC");
@@ -268,3 +296,50 @@ void apic_eoi()
 {
         LAPICEOI = 0x0;
 }
+
+uint8_t apic_getid()
+{
+        return (uint8_t)__lapic_getid();
+}
+
+int apic_getcpus(uint8_t *apicids, int max)
+{
+        int i;
+        for (i = 0; i < nlapics && i < max; ++i) {
+                apicids[i] = lapics[i]->at_apicid;
+        }
+        return i;
+}
+
+void apic_initcpu()
+{
+        LAPICTPR = 0;
+        LAPICSPUR = LAPICSPUR | 0x100;
+}
+
+static void __lapic_sendicr(uint8_t apicid, uint32_t icr)
+{
+        while (LAPICICRLO & ICR_PENDING)
+                ;
+        LAPICICRHI = ((uint32_t)apicid) << 24;
+        /* writing the low half sends the interrupt */
+        LAPICICRLO = icr;
+        while (LAPICICRLO & ICR_PENDING)
+                ;
+}
+
+void apic_sendinit(uint8_t apicid)
+{
+        __lapic_sendicr(apicid, ICR_INIT | ICR_ASSERT);
+}
+
+void apic_sendstartup(uint8_t apicid, uintptr_t paddr)
+{
+        KASSERT(PAGE_ALIGNED(paddr) && paddr < 0x100000);
+        __lapic_sendicr(apicid, ICR_STARTUP | ICR_ASSERT | (paddr >> PAGE_SHIFT));
+}
+
+void apic_sendipi(uint8_t apicid, uint8_t intr)
+{
+        __lapic_sendicr(apicid, ICR_FIXED | ICR_ASSERT | intr);
+}
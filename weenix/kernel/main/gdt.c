@@ -1,4 +1,7 @@
+#include "config.h"
+
 #include "main/gdt.h"
+#include "main/smp.h"
 
 #include "util/printf.h"
 #include "util/debug.h"
@@ -47,18 +50,23 @@ struct gdt_location {
         uint32_t gl_offset;
 } __attribute__((packed));
 
-static struct gdt_entry gdt[GDT_COUNT];
-static struct tss_entry tss;
-static struct gdt_location gdtl = {
-        .gl_size = GDT_COUNT * 8,
-        .gl_offset = (uint32_t) &gdt
-};
+/* Each processor has its own table, if only for its own TSS, whose
+ * kernel stack is that of the thread the processor is running. The
+ * functions below work on the table of the processor calling them. */
+static struct gdt_entry gdts[SMP_MAX_CPUS][GDT_COUNT];
+static struct tss_entry tsss[SMP_MAX_CPUS];
 
 void gdt_init(void)
 {
+        struct gdt_entry *gdt = gdts[cpu_self()->cpu_id];
+        struct tss_entry *tss = &tsss[cpu_self()->cpu_id];
+        struct gdt_location gdtl = {
+                .gl_size = GDT_COUNT * 8,
+                .gl_offset = (uint32_t) gdt
+        };
         struct gdt_location *data = &gdtl;
 
-        memset(&gdt[0], 0, sizeof(gdt));
+        memset(&gdt[0], 0, sizeof(gdts[0]));
 
         gdt_set_entry(GDT_KERNEL_TEXT, 0x0, 0xFFFFF, 0, 1, 0, 1);
         gdt_set_entry(GDT_KERNEL_DATA, 0x0, 0xFFFFF, 0, 0, 0, 1);
@@ -67,14 +75,14 @@ void gdt_init(void)
 
         __asm__ volatile("lgdt (%0)" :: "p"(data));
 
-        gdt_set_entry(GDT_TSS, (uint32_t)&tss, sizeof(tss), 0, 1, 0, 0);
+        gdt_set_entry(GDT_TSS, (uint32_t)tss, sizeof(*tss), 0, 1, 0, 0);
         gdt[GDT_TSS / 8].ge_access &= ~(0b10000);
         gdt[GDT_TSS / 8].ge_access |= 0b1;
         gdt[GDT_TSS / 8].ge_flags &= ~(0b10000000);
 
-        memset(&tss, 0, sizeof(tss));
-        tss.ts_ss0 = GDT_KERNEL_DATA;
-        tss.ts_iopb = sizeof(tss);
+        memset(tss, 0, sizeof(*tss));
+        tss->ts_ss0 = GDT_KERNEL_DATA;
+        tss->ts_iopb = sizeof(*tss);
 
         int segment = GDT_TSS;
         __asm__ volatile("ltr %0" :: "m"(segment));
@@ -82,7 +90,7 @@ void gdt_init(void)
 
 void gdt_set_kernel_stack(void *addr)
 {
-        tss.ts_esp0 = (uint32_t)addr;
+        tsss[cpu_self()->cpu_id].ts_esp0 = (uint32_t)addr;
 }
 
 void gdt_set_entry(uint32_t segment, uint32_t base, uint32_t limit,
@@ -92,6 +100,7 @@ void gdt_set_entry(uint32_t segment, uint32_t base, uint32_t limit,
         KASSERT(ring <= 3);
         KASSERT(limit <= 0xFFFFF);
 
+        struct gdt_entry *gdt = gdts[cpu_self()->cpu_id];
         int index = segment / 8;
         gdt[index].ge_limitlo = (uint16_t)limit;
         gdt[index].ge_baselo = (uint16_t)base;
@@ -113,7 +122,7 @@ void gdt_set_entry(uint32_t segment, uint32_t base, uint32_t limit,
 void gdt_clear(uint32_t segment)
 {
         KASSERT(segment < GDT_COUNT * 8 && 0 == segment % 8);
-        memset(&gdt[segment / 8], 0, sizeof(gdt[segment / 8]));
+        memset(&gdts[cpu_self()->cpu_id][segment / 8], 0, sizeof(struct gdt_entry));
 }
 
 size_t gdt_tss_info(const void *arg, char *buf, size_t osize)
@@ -122,8 +131,11 @@ size_t gdt_tss_info(const void *arg, char *buf, size_t osize)
 
         KASSERT(NULL == arg);
 
-        iprintf(&buf, &size, "TSS:\n");
-        iprintf(&buf, &size, "kstack: %#.8x\n", tss.ts_esp0);
+        uint32_t i;
+        for (i = 0; i < smp_ncpus; ++i) {
+                iprintf(&buf, &size, "TSS (cpu %u):\n", i);
+                iprintf(&buf, &size, "kstack: %#.8x\n", tsss[i].ts_esp0);
+        }
 
         return size;
 }
@@ -8,6 +8,12 @@
 #include "main/interrupt.h"
 #include "main/gdt.h"
 
+#ifdef __UPREEMPT__
+#include "globals.h"
+#include "proc/sched.h"
+#include "proc/kthread.h"
+#endif
+
 #define MAX_INTERRUPTS          256
 
 #define INTR_SPURIOUS      0xef
@@ -379,11 +385,23 @@ static __attribute__((used)) void __intr_handler(regs_t regs)
                 panic("Unhandled interrupt 0x%x\n", regs.r_intr);
         }
 
-        if (0 <= intr_mappings[regs.r_intr]) {
+        /* Mapped IRQs, and the local APIC's own timer and IPIs */
+        if (0 <= intr_mappings[regs.r_intr] || INTR_APICTIMER == regs.r_intr
+            || INTR_IPI_TLB == regs.r_intr) {
                 apic_eoi();
         }
 
         _intr_regs = NULL;
+
+#ifdef __UPREEMPT__
+        /* About to go back to userland, whether from a system call or
+         * any other interrupt: the kernel holds nothing for the current
+         * thread, so this is where it gives up the processor if the
+         * clock said its slice ran out */
+        if (0x3 == (regs.r_cs & 0x3) && curthr->kt_resched) {
+                sched_preempt();
+        }
+#endif
 }
 
 static void __intr_divide_by_zero_handler(regs_t *regs)
@@ -703,3 +721,12 @@ void intr_init()
         intr_register(INTR_GPF, __intr_gpf_handler);
         intr_register(INTR_INVALID_OPCODE, __intr_inval_opcode_handler);
 }
+
+void intr_initcpu()
+{
+        intr_info_t *data = &intr_data;
+
+        __asm__("lidt (%0)" :: "p"(data));
+
+        apic_setspur(INTR_SPURIOUS);
+}
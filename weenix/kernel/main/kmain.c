@@ -22,6 +22,7 @@
 #include "main/interrupt.h"
 #include "main/cpuid.h"
 #include "main/gdt.h"
+#include "main/smp.h"
 
 #include "proc/sched.h"
 #include "proc/proc.h"
@@ -82,6 +83,7 @@ kmain()
         intr_init();
 
         gdt_init();
+        smp_init();
 
         /* initialize slab allocators */
 #ifdef __VM__
@@ -1,30 +1,27 @@
-#include "main/io.h"
-#include "main/interrupt.h"
-#include "util/delay.h"
+#include "config.h"
 
-/* IRQ */
-#define PIT_IRQ 0
+#include "main/io.h"
+#include "util/debug.h"
 
 /* I/O ports */
-#define PIT_DATA0 0x40
-#define PIT_DATA1 0x41
 #define PIT_DATA2 0x42
 #define PIT_CMD   0x43
+#define PIT_GATE  0x61 /* channel 2 gate and output */
 
 #define CLOCK_TICK_RATE 1193182
-#undef HZ
-#define HZ 1000
 
-#define LATCH (CLOCK_TICK_RATE / HZ)
-
-void pit_starttimer(uint8_t intr)
+void pit_delay(unsigned int msecs)
 {
-        intr_map(PIT_IRQ, intr);
+        uint32_t count = CLOCK_TICK_RATE * msecs / 1000;
+
+        KASSERT(count <= 0xffff && "PIT delay too long");
 
-        /* Shamelessly cribbed from "Understanding the Linux Kernel", pp 230 */
-        outb(0x34, PIT_CMD);
-        udelay(10);
-        outb(LATCH & 0xff, PIT_DATA0);
-        udelay(10);
-        outb(LATCH >> 8, PIT_DATA0);
+        /* Gate channel 2 on with the speaker off, and count down once
+         * (mode 0); bit 5 of port 0x61 follows its output, which goes
+         * high when the count runs out */
+        outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+        outb(PIT_CMD, 0xb0);
+        outb(PIT_DATA2, count & 0xff);
+        outb(PIT_DATA2, count >> 8);
+        while (!(inb(PIT_GATE) & 0x20)) ;
 }
@@ -0,0 +1,233 @@
+#include "types.h"
+#include "config.h"
+#include "globals.h"
+#include "kernel.h"
+
+#include "main/smp.h"
+#include "main/apic.h"
+#include "main/gdt.h"
+#include "main/interrupt.h"
+#include "main/pit.h"
+
+#include "mm/page.h"
+#include "mm/tlb.h"
+
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+/*
+ * When built with SMP (see Config.mk), the application processors are
+ * started by smp_init() and each runs an idle loop on its own stack,
+ * GDT and TSS, flushing its TLB when it wakes if a shootdown went by.
+ * Scheduling is still single-processor: there is one run queue, and
+ * only the boot processor takes threads off it. The rest of the kernel
+ * counts on there being a single processor (raising the IPL, curthr,
+ * the page directory loaded by pt_set, the kmap slots in the shared
+ * kernel page table), so nothing else is safe to run on the others
+ * yet, and SMP is off by default.
+ */
+
+/* How long to wait for a processor to come up after each step of
+ * starting it, in milliseconds, as laid out by the MultiProcessor
+ * Specification */
+#define SMP_INIT_MSECS          10
+#define SMP_STARTUP_MSECS       1
+#define SMP_ONLINE_MSECS        100
+
+cpu_t cpus[SMP_MAX_CPUS] = {
+        { .cpu_id = 0, .cpu_online = 1 }
+};
+uint32_t smp_ncpus = 1;
+
+/* cpu_id of the processor with each local APIC id */
+static uint8_t smp_apic_cpu[256];
+
+extern char smp_trampoline[], smp_trampoline_end[];
+extern uint32_t smp_trampoline_cr3, smp_trampoline_cr4;
+extern uint32_t smp_trampoline_stack, smp_trampoline_entry;
+
+/* where one of the fields of the trampoline is in the copy of it at
+ * SMP_TRAMPOLINE, which is identity mapped while smp_init() runs */
+#define TRAMPOLINE_FIELD(field) \
+        (*(uint32_t *)(SMP_TRAMPOLINE + ((char *)&(field) - smp_trampoline)))
+
+/* The shootdown in progress. smp_tlb_gen counts shootdowns, so that
+ * idle processors, which are not interrupted for them, can tell that
+ * their TLB is out of date. */
+static spinlock_t smp_tlb_lock;
+static uintptr_t smp_tlb_vaddr;
+static uint32_t smp_tlb_count;
+static volatile uint32_t smp_tlb_acks;
+static volatile uint32_t smp_tlb_gen;
+
+cpu_t *
+cpu_self(void)
+{
+        return &cpus[smp_apic_cpu[apic_getid()]];
+}
+
+void
+smp_ipi(cpu_t *cpu, uint8_t intr)
+{
+        KASSERT(cpu->cpu_online);
+        apic_sendipi(cpu->cpu_apicid, intr);
+}
+
+void
+smp_tlb_shootdown(uintptr_t vaddr, uint32_t count)
+{
+        cpu_t *self;
+        uint32_t i, sent = 0;
+        uint8_t oldipl;
+
+        if (1 == smp_ncpus) {
+                return;
+        }
+
+        /* Only the boot processor changes mappings, so nothing holding
+         * the lock is ever waiting for this processor to answer. */
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        self = cpu_self();
+        spinlock_lock(&smp_tlb_lock);
+
+        smp_tlb_vaddr = vaddr;
+        smp_tlb_count = count;
+        smp_tlb_acks = 0;
+        ++smp_tlb_gen;
+        self->cpu_tlb_gen = smp_tlb_gen;
+
+        for (i = 0; i < smp_ncpus; ++i) {
+                if (&cpus[i] != self && !cpus[i].cpu_idle) {
+                        smp_ipi(&cpus[i], INTR_IPI_TLB);
+                        ++sent;
+                }
+        }
+        while (smp_tlb_acks < sent) {
+                __asm__ volatile("pause" ::: "memory");
+        }
+
+        spinlock_unlock(&smp_tlb_lock);
+        intr_setipl(oldipl);
+}
+
+static void
+smp_tlb_intr(regs_t *regs)
+{
+        if (TLB_FLUSH_ALL_PAGES < smp_tlb_count) {
+                tlb_flush_global();
+        } else {
+                tlb_flush_range(smp_tlb_vaddr, smp_tlb_count);
+        }
+        cpu_self()->cpu_tlb_gen = smp_tlb_gen;
+
+        __asm__ volatile("lock; incl %0" : "+m"(smp_tlb_acks) :: "memory");
+}
+
+/*
+ * The idle loop of an application processor. Idle processors are left
+ * out of TLB shootdowns, so each time one wakes up it flushes its whole
+ * TLB if there has been one since it last did.
+ */
+static void
+smp_idle(cpu_t *cpu)
+{
+        while (1) {
+                intr_wait();
+                intr_disable();
+                if (cpu->cpu_tlb_gen != smp_tlb_gen) {
+                        cpu->cpu_tlb_gen = smp_tlb_gen;
+                        tlb_flush_global();
+                }
+        }
+}
+
+/*
+ * Where application processors come in from the trampoline, with
+ * paging on and interrupts off.
+ */
+static void
+smp_ap_main(void)
+{
+        cpu_t *cpu = cpu_self();
+
+        gdt_init();
+        apic_initcpu();
+        intr_initcpu();
+
+        cpu->cpu_tlb_gen = smp_tlb_gen;
+        cpu->cpu_idle = 1;
+        cpu->cpu_online = 1;
+
+        smp_idle(cpu);
+}
+
+void
+smp_init(void)
+{
+        uint8_t apicids[SMP_MAX_CPUS];
+        int n, i, ms;
+
+        n = apic_getcpus(apicids, SMP_MAX_CPUS);
+        cpus[0].cpu_apicid = apicids[0];
+        KASSERT(apicids[0] == apic_getid());
+
+        spinlock_init(&smp_tlb_lock);
+        intr_register(INTR_IPI_TLB, smp_tlb_intr);
+
+        dbg(DBG_CORE, "%d processor(s) found\n", n);
+#ifndef __SMP__
+        /* they would only sit in smp_idle() */
+        n = 1;
+#endif
+        if (1 == n) {
+                return;
+        }
+
+        KASSERT((uintptr_t)(smp_trampoline_end - smp_trampoline) <= PAGE_SIZE);
+        memcpy((void *)SMP_TRAMPOLINE, smp_trampoline, smp_trampoline_end - smp_trampoline);
+        __asm__ volatile("movl %%cr3, %0" : "=r"(TRAMPOLINE_FIELD(smp_trampoline_cr3)));
+        __asm__ volatile("movl %%cr4, %0" : "=r"(TRAMPOLINE_FIELD(smp_trampoline_cr4)));
+        TRAMPOLINE_FIELD(smp_trampoline_entry) = (uint32_t)smp_ap_main;
+
+        for (i = 1; i < n; ++i) {
+                cpu_t *cpu = &cpus[smp_ncpus];
+
+                cpu->cpu_id = smp_ncpus;
+                cpu->cpu_apicid = apicids[i];
+                cpu->cpu_online = 0;
+                cpu->cpu_idle = 0;
+                if (NULL == (cpu->cpu_stack = page_alloc())) {
+                        dbg(DBG_CORE, "out of memory starting processors\n");
+                        break;
+                }
+                smp_apic_cpu[cpu->cpu_apicid] = cpu->cpu_id;
+                TRAMPOLINE_FIELD(smp_trampoline_stack) = (uint32_t)cpu->cpu_stack + PAGE_SIZE;
+
+                apic_sendinit(cpu->cpu_apicid);
+                pit_delay(SMP_INIT_MSECS);
+                apic_sendstartup(cpu->cpu_apicid, SMP_TRAMPOLINE);
+                pit_delay(SMP_STARTUP_MSECS);
+                if (!cpu->cpu_online) {
+                        apic_sendstartup(cpu->cpu_apicid, SMP_TRAMPOLINE);
+                }
+                for (ms = 0; ms < SMP_ONLINE_MSECS && !cpu->cpu_online; ++ms) {
+                        pit_delay(1);
+                }
+
+                if (cpu->cpu_online) {
+                        dbg(DBG_CORE, "cpu %u (local APIC 0x%.2x) is up\n",
+                            cpu->cpu_id, (uint32_t)cpu->cpu_apicid);
+                        ++smp_ncpus;
+                } else {
+                        /* the slot goes to the next one */
+                        dbg(DBG_CORE, "local APIC 0x%.2x did not start\n",
+                            (uint32_t)cpu->cpu_apicid);
+                        smp_apic_cpu[cpu->cpu_apicid] = 0;
+                        page_free(cpu->cpu_stack);
+                        cpu->cpu_stack = NULL;
+                }
+        }
+}
@@ -55,7 +55,10 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
         int order;
         for (order = 1; order < PAGE_NSIZES; ++order) {
                 uintptr_t count = npages >> order;
-                count = ((count - 1) & ~((uintptr_t)0x7)) + 8;
+                /* keep at least one byte even if no block of this order
+                 * fits, freeing the largest block that does flips a bit
+                 * in here */
+                count = ((MAX(count, 1) - 1) & ~((uintptr_t)0x7)) + 8;
                 count = count >> 3;
                 end -= count;
                 group->pg_map[order] = (void *)end;
@@ -188,6 +191,7 @@ _page_split(int order)
 {
 #ifdef __SHADOWD__
         uint32_t num_retrys = 2;
+        int slept = 0;
 #else
         uint32_t num_retrys = 0;
 #endif
@@ -204,6 +208,11 @@ _page_split(int order)
                                                 --norder;
                                         }
                                         KASSERT(!list_empty(&group->pg_freelist[order]));
+#ifdef __SHADOWD__
+                                        if (slept) {
+                                                shadowd_alloc_done();
+                                        }
+#endif
                                         return group;
                                 }
                         } list_iterate_end();
@@ -215,13 +224,19 @@ _page_split(int order)
 #ifdef __SHADOWD__
                 dbg(DBG_PAGEALLOC, "waking up shadowd\n");
                 shadowd_wakeup();
-                shadowd_alloc_sleep();
+                shadowd_alloc_sleep(slept);
+                slept = 1;
 #endif
                 int num_freed = slab_allocators_reclaim(0);
                 dbg(DBG_MM, "reclaimed %d pages from slab allocator.\n", num_freed);
         } while (num_retrys-- > 0);
 
         /* We are out of memory, and not even the shadow deamon could free some */
+#ifdef __SHADOWD__
+        if (slept) {
+                shadowd_alloc_done();
+        }
+#endif
         return NULL;
 }
 
@@ -6,6 +6,7 @@
 #include "globals.h"
 
 #include "main/interrupt.h"
+#include "main/cpuid.h"
 
 #include "mm/mm.h"
 #include "mm/page.h"
@@ -17,9 +18,14 @@
 #include "util/debug.h"
 #include "util/string.h"
 #include "util/printf.h"
+#include "util/init.h"
 
 #include "vm/pagefault.h"
 
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
 #include "boot/config.h"
 
 #define PT_ENTRY_COUNT    (PAGE_SIZE / sizeof (uint32_t))
@@ -41,23 +47,49 @@ struct pagedir {
 #define vaddr_to_offset(vaddr) \
         (((uint32_t)(vaddr)) & (~PAGE_MASK))
 
+/* The first page directory entry covers the 4mb below USER_MEM_LOW,
+ * which stays unmapped once pt_template_init has removed the boot
+ * time identity map. The processor ignores the rest of an entry which
+ * is not present, so that entry instead records whether the page
+ * directory has ever been used to run in user mode, and counts its
+ * page tables for user memory in the address bits. */
+#define PD_USER_INDEX     0
+#define PD_RAN_USER       0x200
+#define PD_USER_TABLE     PAGE_SIZE
+
 /* the virtual address of the page directory in cr3 */
 static pagedir_t *current_pagedir = NULL;
+/* the page directory of the running thread, which is only different
+ * from current_pagedir while it is borrowing that one (see pt_set) */
+static pagedir_t *active_pagedir = NULL;
 static pagedir_t *template_pagedir = NULL;
 
-static uint32_t phys_map_count = 1;
 static pte_t *final_page;
 
-uintptr_t
-pt_phys_tmp_map(uintptr_t paddr)
-{
-        KASSERT(PAGE_ALIGNED(paddr));
-        final_page[PT_ENTRY_COUNT - 1] = paddr | PT_PRESENT | PT_WRITE;
+/* The last page table maps, from the top down, the kmap slots, the
+ * page of pt_phys_user_map and then the permanent mappings. Its page
+ * directory entry lets user mode through, so the user page's is the
+ * only one of its entries that does not keep user mode out. */
+#define PT_KMAP_INDEX(i)  (PT_ENTRY_COUNT - PT_KMAP_SLOTS + (i))
+#define PT_KMAP_VADDR(i)  (UPTR_MAX - PAGE_SIZE * (PT_ENTRY_COUNT - PT_KMAP_INDEX(i)) + 1)
+#define PT_UPAGE_INDEX    (PT_KMAP_INDEX(0) - 1)
+#define PT_UPAGE_VADDR    (UPTR_MAX - PAGE_SIZE * (PT_ENTRY_COUNT - PT_UPAGE_INDEX) + 1)
 
-        uintptr_t vaddr = UPTR_MAX - PAGE_SIZE + 1;
-        tlb_flush(vaddr);
-        return vaddr;
-}
+static uint32_t phys_map_count = 1 + PT_KMAP_SLOTS;
+
+/* the kmap slots of the running thread, or of the boot code until the
+ * first thread is made active */
+static uintptr_t boot_kmap_slots[PT_KMAP_SLOTS];
+static uintptr_t *kmap_slots = boot_kmap_slots;
+
+/* PT_GLOBAL if the processor supports global pages, which is
+ * then set on every mapping of kernel memory */
+static pte_t kernel_global = 0;
+
+/* set once CR4.PSE is on, see pt_large_pages */
+static int large_pages = 0;
+
+static int _pt_table_empty(const pte_t *pt);
 
 uintptr_t
 pt_phys_perm_map(uintptr_t paddr, uint32_t count)
@@ -70,14 +102,86 @@ pt_phys_perm_map(uintptr_t paddr, uint32_t count)
         uint32_t i;
         for (i = 0; i < count; ++i) {
                 final_page[PT_ENTRY_COUNT - phys_map_count + i] =
-                        (paddr + PAGE_SIZE * i) | PT_PRESENT | PT_WRITE;
+                        (paddr + PAGE_SIZE * i) | PT_PRESENT | PT_WRITE | kernel_global;
         }
 
         uintptr_t vaddr = UPTR_MAX - (PAGE_SIZE * phys_map_count) + 1;
-        tlb_flush(vaddr);
+        tlb_flush_kernel(vaddr);
         return vaddr;
 }
 
+uintptr_t
+pt_phys_user_map(uintptr_t paddr)
+{
+        KASSERT(PAGE_ALIGNED(paddr));
+        KASSERT(!(PT_PRESENT & final_page[PT_UPAGE_INDEX]));
+
+        final_page[PT_UPAGE_INDEX] = paddr | PT_PRESENT | PT_USER | kernel_global;
+        tlb_flush_kernel(PT_UPAGE_VADDR);
+        return PT_UPAGE_VADDR;
+}
+
+void
+pt_kmap_load(uintptr_t *slots)
+{
+        uint32_t i;
+        for (i = 0; i < PT_KMAP_SLOTS; ++i) {
+                /* leave whatever is in free slots, pt_kmap will reuse it */
+                pte_t pte = slots[i] | PT_PRESENT | PT_WRITE;
+                if (0 != slots[i] && pte != final_page[PT_KMAP_INDEX(i)]) {
+                        final_page[PT_KMAP_INDEX(i)] = pte;
+                        tlb_flush_kernel(PT_KMAP_VADDR(i));
+                }
+        }
+        kmap_slots = slots;
+}
+
+uintptr_t
+pt_kmap(uintptr_t paddr)
+{
+        KASSERT(PAGE_ALIGNED(paddr));
+
+        pte_t pte = paddr | PT_PRESENT | PT_WRITE;
+        int i, slot = -1;
+        for (i = 0; i < PT_KMAP_SLOTS; ++i) {
+                if (0 != kmap_slots[i]) {
+                        continue;
+                }
+                /* a free slot still mapping the page needs no flush */
+                if (pte == final_page[PT_KMAP_INDEX(i)]) {
+                        slot = i;
+                        break;
+                } else if (0 > slot) {
+                        slot = i;
+                }
+        }
+        if (0 > slot) {
+                panic("out of kmap slots mapping physical page %#.8x\n", paddr);
+        }
+
+        kmap_slots[slot] = paddr;
+        if (pte != final_page[PT_KMAP_INDEX(slot)]) {
+                final_page[PT_KMAP_INDEX(slot)] = pte;
+                tlb_flush_kernel(PT_KMAP_VADDR(slot));
+        }
+        return PT_KMAP_VADDR(slot);
+}
+
+void
+pt_kunmap(uintptr_t vaddr)
+{
+        int i;
+        for (i = 0; i < PT_KMAP_SLOTS; ++i) {
+                if (PT_KMAP_VADDR(i) == vaddr) {
+                        KASSERT(0 != kmap_slots[i]);
+                        /* the mapping stays until the slot is reused */
+                        kmap_slots[i] = 0;
+                        return;
+                }
+        }
+        panic("%#.8x is not a kmap address\n", vaddr);
+}
+
 uintptr_t
 pt_virt_to_phys(uintptr_t vaddr)
 {
@@ -85,25 +189,129 @@ pt_virt_to_phys(uintptr_t vaddr)
         uint32_t entry = vaddr_to_ptindex(vaddr);
         uint32_t offset = vaddr_to_offset(vaddr);
 
-        pte_t *pagetable = (pte_t *)pt_phys_tmp_map(current_pagedir->pd_physical[table] & PAGE_MASK);
+        pde_t pde = current_pagedir->pd_physical[table];
+        if (PD_SIZE & pde) {
+                return (pde & ~(PT_VADDR_SIZE - 1)) + (vaddr & (PT_VADDR_SIZE - 1));
+        }
+
+        pte_t *pagetable = (pte_t *)current_pagedir->pd_virtual[table];
         uintptr_t page = pagetable[entry] & PAGE_MASK;
         return page + offset;
 }
 
-void
-pt_set(pagedir_t *pd)
+static void
+_pt_load(pagedir_t *pd)
 {
         uintptr_t pdir = pt_virt_to_phys((uintptr_t)pd->pd_physical);
         current_pagedir = pd;
         __asm__ volatile("movl %0, %%cr3" :: "r"(pdir) : "memory");
 }
 
+void
+pt_set(pagedir_t *pd)
+{
+        active_pagedir = pd;
+        if (pd == current_pagedir) {
+                return;
+        }
+        /* Until a page directory is used to run in user mode, it is
+         * only ever used for the kernel mappings which all page
+         * directories share, so the one in cr3 will do just as well. */
+        if (!(PD_RAN_USER & pd->pd_physical[PD_USER_INDEX])) {
+                return;
+        }
+        _pt_load(pd);
+}
+
+void
+pt_set_user(pagedir_t *pd)
+{
+        KASSERT(!(PD_PRESENT & pd->pd_physical[PD_USER_INDEX]));
+        pd->pd_physical[PD_USER_INDEX] |= PD_RAN_USER;
+        if (pd == active_pagedir && pd != current_pagedir) {
+                _pt_load(pd);
+        }
+}
+
 pagedir_t *
 pt_get(void)
 {
         return current_pagedir;
 }
 
+uint32_t
+pt_user_tables(pagedir_t *pd)
+{
+        return pd->pd_physical[PD_USER_INDEX] / PD_USER_TABLE;
+}
+
+int
+pt_large_pages(void)
+{
+        return large_pages;
+}
+
+/* Turns the 4mb mapping in the given page directory entry into a page
+ * table mapping the same pages with the same permissions. */
+static int
+_pt_split_large(pagedir_t *pd, uint32_t index)
+{
+        pde_t pde = pd->pd_physical[index];
+        uintptr_t paddr = pde & ~(PT_VADDR_SIZE - 1);
+        uint32_t flags = pde & (PT_PRESENT | PT_WRITE | PT_USER);
+        pte_t *pt;
+        uint32_t i;
+
+        KASSERT(PD_SIZE & pde);
+        if (NULL == (pt = page_alloc())) {
+                return -ENOMEM;
+        }
+        for (i = 0; i < PT_ENTRY_COUNT; ++i) {
+                pt[i] = (paddr + i * PAGE_SIZE) | flags;
+        }
+        /* the same translations as before, so the TLB can stay */
+        pd->pd_physical[index] = pt_virt_to_phys((uintptr_t)pt) | PD_PRESENT | PD_WRITE | PD_USER;
+        pd->pd_virtual[index] = pt;
+        return 0;
+}
+
+/* Splits the 4mb mapping in the given entry, or if that cannot be done
+ * drops it altogether. Returns whether a page table is left. */
+static int
+_pt_split_or_drop(pagedir_t *pd, uint32_t index)
+{
+        if (0 == _pt_split_large(pd, index)) {
+                return 1;
+        }
+        pd->pd_physical[index] = 0;
+        pd->pd_physical[PD_USER_INDEX] -= PD_USER_TABLE;
+        return 0;
+}
+
+int
+pt_map_large(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags)
+{
+        KASSERT(large_pages);
+        KASSERT(0 == vaddr % PT_VADDR_SIZE && 0 == paddr % PT_VADDR_SIZE);
+        KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH - PT_VADDR_SIZE >= vaddr);
+        KASSERT((pdflags & ~PAGE_MASK) == pdflags && !(PD_SIZE & pdflags));
+
+        uint32_t index = vaddr_to_pdindex(vaddr);
+
+        if (PT_PRESENT & pd->pd_physical[index]) {
+                pte_t *pt = (pte_t *)pd->pd_virtual[index];
+                if ((PD_SIZE & pd->pd_physical[index]) || !_pt_table_empty(pt)) {
+                        return -EBUSY;
+                }
+                page_free(pt);
+                pd->pd_virtual[index] = NULL;
+        } else {
+                pd->pd_physical[PD_USER_INDEX] += PD_USER_TABLE;
+        }
+        pd->pd_physical[index] = paddr | pdflags | PD_SIZE;
+        return 0;
+}
+
 int
 pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32_t ptflags)
 {
@@ -112,6 +320,10 @@ pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32
 
         int index = vaddr_to_pdindex(vaddr);
 
+        if ((PD_SIZE & pd->pd_physical[index]) && 0 > _pt_split_large(pd, index)) {
+                return -ENOMEM;
+        }
+
         pte_t *pt;
         if (!(PT_PRESENT & pd->pd_physical[index])) {
                 if (NULL == (pt = page_alloc())) {
@@ -121,6 +333,7 @@ pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32
                         memset(pt, 0, PAGE_SIZE);
                         pd->pd_physical[index] = pt_virt_to_phys((uintptr_t)pt) | pdflags;
                         pd->pd_virtual[index] = pt;
+                        pd->pd_physical[PD_USER_INDEX] += PD_USER_TABLE;
                 }
         } else {
                 /* Be sure to add additional pagedir flags if necessary */
@@ -144,6 +357,9 @@ pt_unmap(pagedir_t *pd, uintptr_t vaddr)
 
         int index = vaddr_to_pdindex(vaddr);
 
+        if ((PD_SIZE & pd->pd_physical[index]) && !_pt_split_or_drop(pd, index)) {
+                return;
+        }
         if (PT_PRESENT & pd->pd_physical[index]) {
                 pte_t *pt = (pte_t *)pd->pd_virtual[index];
 
@@ -152,48 +368,161 @@ pt_unmap(pagedir_t *pd, uintptr_t vaddr)
         }
 }
 
-void
-pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
+static int
+_pt_table_empty(const pte_t *pt)
 {
-        uint32_t index;
+        uint32_t i;
+        for (i = 0; i < PT_ENTRY_COUNT; ++i) {
+                if (0 != pt[i]) {
+                        return 0;
+                }
+        }
+        return 1;
+}
 
+static void
+_pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh, tlb_gather_t *tg)
+{
         KASSERT(vlow < vhigh);
         KASSERT(PAGE_ALIGNED(vlow) && PAGE_ALIGNED(vhigh));
         KASSERT(USER_MEM_LOW <= vlow && USER_MEM_HIGH >= vhigh);
 
-        index = vaddr_to_ptindex(vlow);
-        if (PT_PRESENT & pd->pd_physical[vaddr_to_pdindex(vlow)] && index != 0) {
-                pte_t *pt = (pte_t *)pd->pd_virtual[vaddr_to_pdindex(vlow)];
-                size_t size = (PT_ENTRY_COUNT - index) * sizeof(*pt);
-                memset(&pt[index], 0, size);
+        if (NULL != tg) {
+                tlb_gather_range(tg, vlow, vhigh);
         }
-        vlow += PAGE_SIZE * ((PT_ENTRY_COUNT - index) % PT_ENTRY_COUNT);
 
-        index = vaddr_to_ptindex(vhigh);
-        if (PT_PRESENT & pd->pd_physical[vaddr_to_pdindex(vhigh)] && index != 0) {
-                pte_t *pt = (pte_t *)pd->pd_virtual[vaddr_to_pdindex(vhigh)];
-                size_t size = index * sizeof(*pt);
-                memset(&pt[0], 0, size);
+        while (vlow < vhigh) {
+                uint32_t index = vaddr_to_pdindex(vlow);
+                uintptr_t end = MIN(vhigh, (uintptr_t)(index + 1) * PT_VADDR_SIZE);
+                uint32_t count = (end - vlow) >> PAGE_SHIFT;
+
+                if (PD_SIZE & pd->pd_physical[index]) {
+                        /* the pages belong to their pframes, not to us */
+                        if (PT_ENTRY_COUNT == count) {
+                                pd->pd_physical[index] = 0;
+                                pd->pd_physical[PD_USER_INDEX] -= PD_USER_TABLE;
+                        } else {
+                                _pt_split_or_drop(pd, index);
+                        }
+                }
+                if (PT_PRESENT & pd->pd_physical[index]) {
+                        pte_t *pt = (pte_t *)pd->pd_virtual[index];
+
+                        if (PT_ENTRY_COUNT > count) {
+                                memset(&pt[vaddr_to_ptindex(vlow)], 0, count * sizeof(*pt));
+                        }
+                        /* give back page tables which no longer map anything */
+                        if (PT_ENTRY_COUNT == count || _pt_table_empty(pt)) {
+                                if (NULL != tg) {
+                                        tlb_gather_free(tg, pt);
+                                } else {
+                                        page_free(pt);
+                                }
+                                pd->pd_virtual[index] = NULL;
+                                pd->pd_physical[index] = 0;
+                                pd->pd_physical[PD_USER_INDEX] -= PD_USER_TABLE;
+                        }
+                }
+                vlow = end;
         }
-        vhigh -= PAGE_SIZE * index;
+}
 
-        uint32_t i;
-        for (i = vaddr_to_pdindex(vlow); i < vaddr_to_pdindex(vhigh); ++i) {
-                if (PT_PRESENT & pd->pd_physical[i]) {
-                        page_free(pd->pd_virtual[i]);
-                        pd->pd_virtual[i] = NULL;
-                        pd->pd_physical[i] = 0;
+int
+pt_copy_range(pagedir_t *dst, pagedir_t *src, uintptr_t vlow, uintptr_t vhigh, int cow)
+{
+        KASSERT(vlow < vhigh);
+        KASSERT(PAGE_ALIGNED(vlow) && PAGE_ALIGNED(vhigh));
+        KASSERT(USER_MEM_LOW <= vlow && USER_MEM_HIGH >= vhigh);
+
+        while (vlow < vhigh) {
+                uint32_t index = vaddr_to_pdindex(vlow);
+                uintptr_t end = MIN(vhigh, (uintptr_t)(index + 1) * PT_VADDR_SIZE);
+
+                if ((PD_SIZE & src->pd_physical[index]) && !(PT_PRESENT & dst->pd_physical[index])
+                    && (uintptr_t)index * PT_VADDR_SIZE == vlow && end - vlow == PT_VADDR_SIZE) {
+                        /* share the whole 4mb page; a write fault on
+                         * either side splits it */
+                        if (cow) {
+                                src->pd_physical[index] &= ~PD_WRITE;
+                        }
+                        dst->pd_physical[index] = src->pd_physical[index];
+                        dst->pd_physical[PD_USER_INDEX] += PD_USER_TABLE;
+                        vlow = end;
+                        continue;
                 }
+                if (PD_SIZE & src->pd_physical[index]) {
+                        _pt_split_or_drop(src, index);
+                }
+                if (PD_SIZE & dst->pd_physical[index]) {
+                        _pt_split_or_drop(dst, index);
+                }
+                if (PT_PRESENT & src->pd_physical[index]) {
+                        pte_t *spt = (pte_t *)src->pd_virtual[index];
+                        pte_t *dpt;
+
+                        if (!(PT_PRESENT & dst->pd_physical[index])) {
+                                if (NULL == (dpt = page_alloc())) {
+                                        return -ENOMEM;
+                                }
+                                memset(dpt, 0, PAGE_SIZE);
+                                dst->pd_physical[index] = pt_virt_to_phys((uintptr_t)dpt)
+                                                          | (src->pd_physical[index] & ~PAGE_MASK);
+                                dst->pd_virtual[index] = dpt;
+                                dst->pd_physical[PD_USER_INDEX] += PD_USER_TABLE;
+                        } else {
+                                dpt = (pte_t *)dst->pd_virtual[index];
+                        }
+
+                        uint32_t i = vaddr_to_ptindex(vlow);
+                        uint32_t last = i + ((end - vlow) >> PAGE_SHIFT);
+                        for (; i < last; ++i) {
+                                if (cow && (PT_WRITE & spt[i])) {
+                                        spt[i] &= ~PT_WRITE;
+                                }
+                                dpt[i] = spt[i];
+                        }
+                }
+                vlow = end;
         }
+        return 0;
+}
+
+void
+pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
+{
+        _pt_unmap_range(pd, vlow, vhigh, NULL);
+}
+
+void
+pt_unmap_range_gather(tlb_gather_t *tg, uintptr_t vlow, uintptr_t vhigh)
+{
+        _pt_unmap_range(tg->tg_pd, vlow, vhigh, tg);
 }
 
 
+/* Page directories ready to be handed out by pt_create_pagedir, which
+ * look exactly like the template. pagedird tops the cache up in the
+ * background and pt_destroy_pagedir returns directories to it. */
+static pagedir_t *pagedir_cache[PT_PAGEDIR_CACHE_SIZE];
+static uint32_t pagedir_cache_count = 0;
+
+static kthread_t *pagedird_thr = NULL;
+static ktqueue_t pagedird_waitq;
+
 pagedir_t *
 pt_create_pagedir()
 {
         KASSERT(sizeof(pagedir_t) == PAGE_SIZE * 2);
 
         pagedir_t *pdir;
+        if (0 < pagedir_cache_count) {
+                pdir = pagedir_cache[--pagedir_cache_count];
+                if (NULL != pagedird_thr && pagedir_cache_count < PT_PAGEDIR_CACHE_SIZE / 2) {
+                        sched_wakeup_on(&pagedird_waitq);
+                }
+                return pdir;
+        }
+
         if (NULL == (pdir = page_alloc_n(2))) {
                 return NULL;
         }
@@ -206,20 +535,83 @@ void
 pt_destroy_pagedir(pagedir_t *pdir)
 {
         KASSERT(PAGE_ALIGNED(pdir));
+        KASSERT(pdir != active_pagedir);
+
+        /* some kernel thread may still be borrowing it */
+        if (pdir == current_pagedir) {
+                _pt_load(active_pagedir);
+        }
 
         uint32_t begin = USER_MEM_LOW / PT_VADDR_SIZE;
         uint32_t end = (USER_MEM_HIGH - 1) / PT_VADDR_SIZE;
         KASSERT(begin < end && begin > 0);
 
-        uint32_t i;
+        /* clear the user half on the way, so that the directory ends up
+         * identical to the template again. Every entry is looked at, as
+         * leaving one behind would hand a stale mapping to the next
+         * process; the count of them is only checked. */
+        uint32_t i, found = 0;
         for (i = begin; i <= end; ++i) {
                 if (PT_PRESENT & pdir->pd_physical[i]) {
-                        page_free(pdir->pd_virtual[i]);
+                        if (!(PD_SIZE & pdir->pd_physical[i])) {
+                                page_free(pdir->pd_virtual[i]);
+                        }
+                        pdir->pd_virtual[i] = NULL;
+                        pdir->pd_physical[i] = 0;
+                        ++found;
+                }
+        }
+        KASSERT(found == pt_user_tables(pdir));
+        pdir->pd_physical[PD_USER_INDEX] = 0;
+
+        if (pagedir_cache_count < PT_PAGEDIR_CACHE_SIZE) {
+                pagedir_cache[pagedir_cache_count++] = pdir;
+        } else {
+                page_free_n(pdir, 2);
+        }
+}
+
+/*
+ * Keeps the page directory cache filled, so that creating a process
+ * does not have to allocate and copy one. It only does work once the
+ * cache has been drawn down to half its size.
+ */
+static void *
+pagedird_run(int arg1, void *arg2)
+{
+        while (1) {
+                while (pagedir_cache_count < PT_PAGEDIR_CACHE_SIZE) {
+                        pagedir_t *pdir = page_alloc_n(2);
+                        if (NULL == pdir) {
+                                break;
+                        }
+                        memcpy(pdir, template_pagedir, sizeof(*pdir));
+                        pagedir_cache[pagedir_cache_count++] = pdir;
+                }
+
+                if (sched_cancellable_sleep_on(&pagedird_waitq)) {
+                        kthread_exit((void *)0);
                 }
         }
-        page_free_n(pdir, 2);
+        return NULL;
 }
 
+static __attribute__((unused)) void
+pagedird_init(void)
+{
+        sched_queue_init(&pagedird_waitq);
+
+        KASSERT(NULL != curproc && (PID_IDLE == curproc->p_pid));
+        proc_t *pagedird = proc_create("pagedird");
+        KASSERT(NULL != pagedird);
+        pagedird_thr = kthread_create(pagedird, pagedird_run, 0, NULL);
+        KASSERT(NULL != pagedird_thr);
+
+        sched_make_runnable(pagedird_thr);
+}
+init_func(pagedird_init);
+init_depends(sched_init);
+
 static void
 _pt_fault_handler(regs_t *regs)
 {
@@ -231,6 +623,7 @@ _pt_fault_handler(regs_t *regs)
         /* Check if pagefault was in user space (otherwise, BAD!) */
         if (cause & FAULT_USER) {
                 handle_pagefault(vaddr, cause);
+                pagefault_apply_advice(vaddr);
         } else {
                 panic("\nPage faulted while accessing 0x%08x\n", vaddr);
         }
@@ -256,13 +649,31 @@ _pt_fill_page(pagedir_t *pd, pte_t *pt, pde_t pdflags, pte_t ptflags,
 
         pde_t *temppdir;
         __asm__ volatile("movl %%cr3, %0" : "=r"(temppdir));
-        pte_t *pagetable = (pte_t *)pt_phys_tmp_map(temppdir[table] & PAGE_MASK);
+        pte_t *pagetable = (pte_t *)pt_kmap(temppdir[table] & PAGE_MASK);
         uintptr_t page = pagetable[entry] & PAGE_MASK;
+        pt_kunmap((uintptr_t)pagetable);
 
         pd->pd_physical[base] = page | (pdflags & ~(PAGE_MASK));
         pd->pd_virtual[base] = pt;
 }
 
+/* Sets the given bit in cr4 if the processor has the given
+ * cpuid feature, returns whether it did. */
+static int
+_pt_enable_feature(uint32_t feature, uint32_t cr4bit)
+{
+        uint32_t a, d, cr4;
+        cpuid(CPUID_GETFEATURES, &a, &d);
+        if (!(d & feature)) {
+                return 0;
+        }
+
+        __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+        cr4 |= cr4bit;
+        __asm__ volatile("movl %0, %%cr4" :: "r"(cr4) : "memory");
+        return 1;
+}
+
 void
 pt_init(void)
 {
@@ -275,6 +686,12 @@ pt_init(void)
         pde_t *temppdir;
         __asm__ volatile("movl %%cr3, %0" : "=r"(temppdir));
 
+        /* kernel memory is mapped the same way in every page
+         * directory, so keep its TLB entries when switching */
+        if (_pt_enable_feature(CPUID_FEAT_EDX_PGE, CR4_PGE)) {
+                kernel_global = PT_GLOBAL;
+        }
+
         pagedir_t *pagedir = (pagedir_t *)&kernel_end;
         /* The kernel ending address should be page aligned by the linker script */
         KASSERT(PAGE_ALIGNED(pagedir));
@@ -286,7 +703,7 @@ pt_init(void)
         memset(final_page, 0, PAGE_SIZE);
         temppdir[PT_ENTRY_COUNT - 1] = ((uintptr_t)final_page
                                         - (uintptr_t)&kernel_start + KERNEL_PHYS_BASE) | PT_PRESENT | PT_WRITE;
-        pagedir->pd_physical[PT_ENTRY_COUNT - 1] = temppdir[PT_ENTRY_COUNT - 1];
+        pagedir->pd_physical[PT_ENTRY_COUNT - 1] = temppdir[PT_ENTRY_COUNT - 1] | PD_USER;
         pagedir->pd_virtual[PT_ENTRY_COUNT - 1] = final_page;
 
         /* identity map the first 4mb (one page table) of physical memory */
@@ -297,25 +714,76 @@ pt_init(void)
          * this will make our new page table identical to the temporary
          * page table the boot loader created. */
         pagetable += PT_ENTRY_COUNT;
-        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE,
+        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE | kernel_global,
                       (uintptr_t)&kernel_start, KERNEL_PHYS_BASE);
 
         current_pagedir = pagedir;
+        active_pagedir = pagedir;
         /* swap the temporary page table with our identical, but more
          * permanant page table */
-        pt_set(pagedir);
+        _pt_load(pagedir);
 
         uintptr_t physmax = phys_detect_highmem();
         dbgq(DBG_MM, "Highest usable physical memory: 0x%08x\n", physmax);
         dbgq(DBG_MM, "Available memory: 0x%08x\n", physmax - KERNEL_PHYS_BASE);
 
-        uintptr_t vaddr = ((uintptr_t)&kernel_start);
-        uintptr_t paddr = KERNEL_PHYS_BASE;
+        uintptr_t vaddr = ((uintptr_t)&kernel_start) + PT_VADDR_SIZE;
+        uintptr_t paddr = KERNEL_PHYS_BASE + PT_VADDR_SIZE;
+
+        if (paddr < physmax && _pt_enable_feature(CPUID_FEAT_EDX_PSE, CR4_PSE)) {
+                /* The kernel is linked at a 4mb aligned address but loaded
+                 * 1mb into physical memory, so the rest of physical memory
+                 * can never be mapped with 4mb pages if we keep mapping it
+                 * right after the kernel. Instead map physical memory from
+                 * the next 4mb boundary on at kernel_start + paddr with one
+                 * 4mb page per page directory entry, and only fall back to
+                 * a page table for the last partial 4mb. The first large
+                 * page maps the last 1mb of the kernel's page table again,
+                 * so that part of it is skipped when handing out memory. */
+                uintptr_t pstart = paddr;
+                paddr &= ~(PT_VADDR_SIZE - 1);
+                vaddr = ((uintptr_t)&kernel_start) + paddr;
+                KASSERT(0 == vaddr % PT_VADDR_SIZE);
+
+                while (paddr + PT_VADDR_SIZE <= physmax) {
+                        pagedir->pd_physical[vaddr_to_pdindex(vaddr)] =
+                                paddr | PD_PRESENT | PD_WRITE | PD_SIZE | kernel_global;
+                        vaddr += PT_VADDR_SIZE;
+                        paddr += PT_VADDR_SIZE;
+                }
+                if (paddr < physmax) {
+                        pagetable += PT_ENTRY_COUNT;
+                        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE | kernel_global, vaddr, paddr);
+                }
+
+                /* The page allocator aligns its blocks to the start of
+                 * each range it is given, so start a new range at the
+                 * first 4mb boundary for the 4mb blocks user memory can
+                 * be mapped with to be 4mb aligned in physical memory. */
+                uintptr_t paligned = (pstart + PT_VADDR_SIZE - 1) & ~(PT_VADDR_SIZE - 1);
+                large_pages = 1;
+
+                page_add_range((uintptr_t) pagetable + PT_ENTRY_COUNT,
+                               ((uintptr_t)&kernel_start) + PT_VADDR_SIZE);
+                if (paligned < physmax) {
+                        page_add_range(((uintptr_t)&kernel_start) + pstart,
+                                       ((uintptr_t)&kernel_start) + paligned);
+                        page_add_range(((uintptr_t)&kernel_start) + paligned,
+                                       ((uintptr_t)&kernel_start) + physmax);
+                } else {
+                        page_add_range(((uintptr_t)&kernel_start) + pstart,
+                                       ((uintptr_t)&kernel_start) + physmax);
+                }
+                return;
+        }
+
+        vaddr = ((uintptr_t)&kernel_start);
+        paddr = KERNEL_PHYS_BASE;
         do {
                 pagetable += PT_ENTRY_COUNT;
                 vaddr += PT_VADDR_SIZE;
                 paddr += PT_VADDR_SIZE;
-                _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE, vaddr, paddr);
+                _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE | kernel_global, vaddr, paddr);
         } while (paddr < physmax);
 
         page_add_range((uintptr_t) pagetable + PT_ENTRY_COUNT, physmax + ((uintptr_t)&kernel_start) - KERNEL_PHYS_BASE);
@@ -327,9 +795,13 @@ pt_template_init()
         /* the current page directory should be the same one set up by
          * the pt_init function above, it needs to be slighly modified
          * to remove the mapping of the first 4mb and then saved in a
-         * seperate page as the template */
-        memset(current_pagedir->pd_virtual[0], 0, PAGE_SIZE);
-        tlb_flush_all();
+         * seperate page as the template. The boot loader marked the
+         * first 4mb global, so flush global entries too. */
+        KASSERT(0 == vaddr_to_pdindex(USER_MEM_LOW - 1));
+        current_pagedir->pd_physical[PD_USER_INDEX] = 0;
+        current_pagedir->pd_virtual[PD_USER_INDEX] = NULL;
+        tlb_flush_global();
+        smp_tlb_shootdown(0, PT_ENTRY_COUNT);
 
         template_pagedir = page_alloc_n(2);
         KASSERT(NULL != template_pagedir);
@@ -357,8 +829,14 @@ pt_mapping_info(const void *pt, char *buf, size_t osize)
 
         while (PT_ENTRY_COUNT > pdi) {
                 pte_t *entry = NULL;
+                pte_t large;
                 if (PD_PRESENT & pagedir->pd_physical[pdi]) {
-                        if (PT_PRESENT & pagedir->pd_virtual[pdi][pti]) {
+                        if (PD_SIZE & pagedir->pd_physical[pdi]) {
+                                /* pretend 4mb pages are made of 4kb ones */
+                                large = (pagedir->pd_physical[pdi] & ~(PT_VADDR_SIZE - 1))
+                                        + pti * PAGE_SIZE;
+                                entry = &large;
+                        } else if (PT_PRESENT & pagedir->pd_virtual[pdi][pti]) {
                                 entry = &pagedir->pd_virtual[pdi][pti];
                         }
                 } else {
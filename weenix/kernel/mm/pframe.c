@@ -16,6 +16,7 @@
 #include "mm/pagetable.h"
 
 #include "vm/vmmap.h"
+#include "vm/anon.h"
 
 /*
  * In this file, physical pages (as represented by pframes) will be
@@ -101,13 +102,14 @@ static proc_t *pageoutd = NULL;
 static kthread_t *pageoutd_thr = NULL;
 static ktqueue_t pageoutd_waitq;
 
-/* threads waiting for pageoutd to run sleep on this queue */
+/* threads waiting for pageoutd to run sleep on this queue, as exclusive
+ * waiters */
 static ktqueue_t alloc_waitq;
 
 /* Pageout daemon functions */
 static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
-#define pageoutd_wakeup()        (sched_broadcast_on(&pageoutd_waitq))
+#define pageoutd_wakeup()        (sched_wakeup_on(&pageoutd_waitq))
 #define pageoutd_needed()        \
 	((page_free_count() <= nfreepages_min) && (!list_empty(&alloc_list)))
 #define pageoutd_target_met()    (page_free_count() >= nfreepages_target)
@@ -188,6 +190,26 @@ pframe_shutdown()
  */
 pframe_t *
 pframe_get_resident(struct mmobj *o, uint32_t pagenum)
+{
+        pframe_t *pf;
+
+        /* It is up to the caller to recognize/care if the page is busy. */
+        if (NULL != (pf = pframe_find_resident(o, pagenum))
+            && !pframe_is_pinned(pf)) {
+                /* send to back of alloc_list */
+                list_remove(&pf->pf_link);
+                list_insert_tail(&alloc_list, &pf->pf_link);
+        }
+        return pf;
+}
+
+/*
+ * Like pframe_get_resident(), but leaves the page where it is in the
+ * LRU. For callers which only want to know whether a page is resident
+ * and are not about to use it.
+ */
+pframe_t *
+pframe_find_resident(struct mmobj *o, uint32_t pagenum)
 {
         list_t *hashchain;
         pframe_t *pf;
@@ -195,14 +217,6 @@ pframe_get_resident(struct mmobj *o, uint32_t pagenum)
         hashchain = &pframe_hash[hash_page(o, pagenum)];
         list_iterate_begin(hashchain, pf, pframe_t, pf_hlink) {
                 if ((o == pf->pf_obj) && (pagenum == pf->pf_pagenum)) {
-                        /* found a page with the specified identity. It is
-                         * up to the caller to recognize/care if the page
-                         * is busy. */
-                        if (!pframe_is_pinned(pf)) {
-                                /* send to back of alloc_list */
-                                list_remove(&pf->pf_link);
-                                list_insert_tail(&alloc_list, &pf->pf_link);
-                        }
                         return pf;
                 }
         } list_iterate_end();
@@ -210,6 +224,32 @@ pframe_get_resident(struct mmobj *o, uint32_t pagenum)
         return NULL;
 }
 
+/*
+ * Initializes a newly allocated pframe for the page at addr, which is to
+ * hold the page identified by the object and page number, and makes it
+ * resident.
+ */
+static void
+_pframe_init(pframe_t *pf, mmobj_t *o, uint32_t pagenum, void *addr)
+{
+        pf->pf_addr = addr;
+
+        nallocated++;
+        list_insert_tail(&alloc_list, &pf->pf_link);
+
+        pf->pf_obj = o;
+        pf->pf_pagenum = pagenum;
+        pf->pf_flags = 0;
+        sched_queue_init(&pf->pf_waitq);
+        pf->pf_pincount = 0;
+
+        list_insert_head(&pframe_hash[hash_page(o, pagenum)], &pf->pf_hlink);
+
+        o->mmo_ops->ref(o);
+        o->mmo_nrespages++;
+        list_insert_head(&o->mmo_respages, &pf->pf_olink);
+}
+
 /*
  * Allocate a pframe to hold the page identified by the object and page number.
  * The given page should not already be resident.
@@ -227,37 +267,55 @@ static pframe_t *
 pframe_alloc(mmobj_t *o, uint32_t pagenum)
 {
         pframe_t *pf;
+        void *addr;
         if (NULL == (pf = slab_obj_alloc(pframe_allocator))) {
                 dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
                 return NULL;
         }
-        if (NULL == (pf->pf_addr = page_alloc())) {
+        if (NULL == (addr = page_alloc())) {
                 dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
                 slab_obj_free(pframe_allocator, pf);
                 return NULL;
         }
 
-        nallocated++;
-        list_insert_tail(&alloc_list, &pf->pf_link);
-
-        pf->pf_obj = o;
-        pf->pf_pagenum = pagenum;
-        pf->pf_flags = 0;
-        sched_queue_init(&pf->pf_waitq);
-        pf->pf_pincount = 0;
+        _pframe_init(pf, o, pagenum, addr);
+        return pf;
+}
 
-        list_insert_head(&pframe_hash[hash_page(o, pagenum)], &pf->pf_hlink);
+/*
+ * Makes a page the caller allocated from the page allocator, and has
+ * already filled, resident as the page identified by the object and
+ * page number, which must not be resident yet. From then on the page is
+ * managed like any other; in particular pframe_free() gives it back
+ * with page_free(), so it may be one page out of a larger block.
+ *
+ * @param o the mmobj identifying this page
+ * @param pagenum the page number of this page in the object
+ * @param addr the page
+ *
+ * @return a new pframe, or NULL if there is no memory for it
+ */
+pframe_t *
+pframe_adopt(mmobj_t *o, uint32_t pagenum, void *addr)
+{
+        pframe_t *pf;
 
-        o->mmo_ops->ref(o);
-        o->mmo_nrespages++;
-        list_insert_head(&o->mmo_respages, &pf->pf_olink);
+        KASSERT(PAGE_ALIGNED(addr));
+        KASSERT(NULL == pframe_get_resident(o, pagenum));
 
+        if (NULL == (pf = slab_obj_alloc(pframe_allocator))) {
+                dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
+                return NULL;
+        }
+        _pframe_init(pf, o, pagenum, addr);
         return pf;
 }
 
 /*
  * Fills the contents of the page (using the mmobj's fillpage op).
- * Make sure to mark the page busy while it's being filled.
+ * Make sure to mark the page busy while it's being filled. Pages which
+ * are read in (that is, not those of anonymous and shadow objects) are
+ * counted as page-ins of the current process.
  * @param pf the page to fill
  */
 static int
@@ -265,6 +323,11 @@ pframe_fill(pframe_t *pf)
 {
         int ret;
 
+        if (NULL != curproc && NULL == pf->pf_obj->mmo_shadowed
+            && !mmobj_is_anon(pf->pf_obj)) {
+                curproc->p_rusage.ru_pageins++;
+        }
+
         pframe_set_busy(pf);
         ret = pf->pf_obj->mmo_ops->fillpage(pf->pf_obj, pf);
         pframe_clear_busy(pf);
@@ -281,11 +344,22 @@ pframe_fill(pframe_t *pf)
  * case this routine may block). Before allocating the new pframe, we check to
  * see if we need to call pageoutd and wake it up if necessary.
  *
+ * If pageoutd is needed, wake it and wait for it with
+ * sched_sleep_on_exclusive() on alloc_waitq: it only wakes the first
+ * thread waiting there, which must pass the wakeup on with
+ * sched_wakeup_on() once it has its page (or has given up). If there is
+ * still not enough memory when it wakes, count the wakeup with
+ * sched_queue_spurious() before sleeping again.
+ *
  * If the page is found (resident) but busy, then we will wait for it to become
  * unbusy and then try again (since it may have been freed after that). Thus,
  * as long as this routine returns successfully, the returned page will be a
  * non-busy page that will be guaranteed to remain resident until the calling
- * context blocks without first pinning the page.
+ * context blocks without first pinning the page. Waiters for a busy page
+ * are not exclusive: once the page is not busy all of them can use it,
+ * and since it may be freed before a woken waiter runs, the waiter could
+ * not safely pass a wakeup on. If the page is busy again after waking,
+ * count that with sched_queue_spurious().
  *
  * This routine may block at the mmobj operation level.
  *
@@ -341,6 +415,25 @@ pframe_migrate(pframe_t *pf, mmobj_t *dest)
         }
 }
 
+/*
+ * Moves an allocated (unpinned) page to the front of the allocated list,
+ * making it the next page pageoutd will reclaim. This is the opposite of
+ * what pframe_get_resident does, and is used to drop the pages behind a
+ * sequential scan (see madvise(2)) before the rest of the cache.
+ *
+ * @param pf the page to deactivate
+ */
+void
+pframe_deactivate(pframe_t *pf)
+{
+        KASSERT(!pframe_is_free(pf));
+
+        if (!pframe_is_pinned(pf)) {
+                list_remove(&pf->pf_link);
+                list_insert_head(&alloc_list, &pf->pf_link);
+        }
+}
+
 /*
  * Increases the pin count on this page. Pages with a pin count > 0 will not be
  * paged out by pageoutd, so this ensures that the page will remain resident
@@ -447,6 +540,31 @@ pframe_clean(pframe_t *pf)
         return ret;
 }
 
+/* Does the work of pframe_remove_from_pts, recording the addresses
+ * unmapped from tg's page directory in tg. */
+static void
+_pframe_remove_from_pts(pframe_t *pf, tlb_gather_t *tg)
+{
+        vmarea_t *vma;
+        list_iterate_begin(mmobj_bottom_vmas(pf->pf_obj), vma, vmarea_t, vma_olink) {
+                /* Get the virtual address in the area corresponding to this pf */
+                if ((pf->pf_pagenum >= vma->vma_off)
+                    && (pf->pf_pagenum < vma->vma_off + (vma->vma_end - vma->vma_start))) {
+                        uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(vma->vma_start + pf->pf_pagenum - vma->vma_off);
+                        /* And unmap it from that area's proc */
+                        if (NULL != vma->vma_vmmap->vmm_proc) {
+                                pagedir_t *pd = vma->vma_vmmap->vmm_proc->p_pagedir;
+                                pt_unmap(pd, vaddr);
+                                /* we may be borrowing its page directory */
+                                if (pd == tg->tg_pd) {
+                                        tlb_gather_page(tg, vaddr);
+                                }
+                        }
+                }
+
+        } list_iterate_end();
+}
+
 /*
  * Deallocates a pframe (reclaims the page frame for use by something else).
  * The page should not be pinned, free, or busy. Note that if the page is dirty
@@ -457,20 +575,35 @@ pframe_clean(pframe_t *pf)
  */
 void
 pframe_free(pframe_t *pf)
+{
+        tlb_gather_t tg;
+        tlb_gather_init(&tg, pt_get());
+        pframe_free_gather(&tg, pf);
+        tlb_gather_finish(&tg);
+}
+
+/*
+ * Like pframe_free(), but the TLB invalidations for the loaded page
+ * directory are collected in tg, whose page directory must be the
+ * loaded one, and the page frame itself is only given back by
+ * tlb_gather_finish(). Callers freeing many pages use this to flush
+ * once for all of them.
+ */
+void
+pframe_free_gather(tlb_gather_t *tg, pframe_t *pf)
 {
         KASSERT(!pframe_is_pinned(pf));
         KASSERT(!pframe_is_free(pf));
         KASSERT(!pframe_is_busy(pf));
+        KASSERT(pt_get() == tg->tg_pd);
 
         dbg(DBG_PFRAME, "uncaching page %d of obj %p\n", pf->pf_pagenum, pf->pf_obj);
 
         mmobj_t *o = pf->pf_obj;
 
-
-        /* Flush the TLB */
-        tlb_flush((uintptr_t) pf->pf_addr);
-        /* Remove from all pagetables that map it */
-        pframe_remove_from_pts(pf);
+        /* Remove from all pagetables that map it; the kernel's own
+         * mapping of the frame never changes */
+        _pframe_remove_from_pts(pf, tg);
 
         list_remove(&pf->pf_hlink);
 
@@ -478,7 +611,7 @@ pframe_free(pframe_t *pf)
         nallocated--;
         list_remove(&pf->pf_link);
 
-        page_free(pf->pf_addr);
+        tlb_gather_free(tg, pf->pf_addr);
         slab_obj_free(pframe_allocator, pf);
 
         o->mmo_nrespages--;
@@ -498,6 +631,8 @@ void
 pframe_clean_all()
 {
         pframe_t *pf;
+        mmobj_t *waitobj = NULL;        /* the page last waited for; */
+        uint32_t waitpage = 0;          /* its pframe may have been reused */
         dbg(DBG_PFRAME, "pframe_clean_all: starting (this may take a while)\n");
 
         /*
@@ -512,6 +647,11 @@ list_start:
                 KASSERT(!pframe_is_pinned(pf));
                 KASSERT(!pframe_is_free(pf));
                 if (pframe_is_busy(pf)) {
+                        if (pf->pf_obj == waitobj && pf->pf_pagenum == waitpage) {
+                                sched_queue_spurious(&pf->pf_waitq);
+                        }
+                        waitobj = pf->pf_obj;
+                        waitpage = pf->pf_pagenum;
                         sched_sleep_on(&pf->pf_waitq);
                         goto list_start;
                 }
@@ -534,19 +674,10 @@ list_start:
 void
 pframe_remove_from_pts(pframe_t *pf)
 {
-        vmarea_t *vma;
-        list_iterate_begin(mmobj_bottom_vmas(pf->pf_obj), vma, vmarea_t, vma_olink) {
-                /* Get the virtual address in the area corresponding to this pf */
-                if ((pf->pf_pagenum >= vma->vma_off)
-                    && (pf->pf_pagenum < vma->vma_off + (vma->vma_end - vma->vma_start))) {
-                        uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(vma->vma_start + pf->pf_pagenum - vma->vma_off);
-                        /* And unmap it from that area's proc */
-                        if (NULL != vma->vma_vmmap->vmm_proc) {
-                                pt_unmap(vma->vma_vmmap->vmm_proc->p_pagedir, vaddr);
-                        }
-                }
-
-        } list_iterate_end();
+        tlb_gather_t tg;
+        tlb_gather_init(&tg, pt_get());
+        _pframe_remove_from_pts(pf, &tg);
+        tlb_gather_finish(&tg);
 }
 
 /* ------------------------------------------------------------------ */
@@ -577,6 +708,27 @@ pageoutd_init(void)
 init_func(pageoutd_init);
 init_depends(sched_init);
 
+/*
+ * Counts a page pageoutd is about to write back as a page-out of each
+ * process which maps it.
+ */
+static void
+pageoutd_account(pframe_t *pf)
+{
+        vmarea_t *vma;
+        proc_t *last = NULL;
+
+        list_iterate_begin(mmobj_bottom_vmas(pf->pf_obj), vma, vmarea_t, vma_olink) {
+                proc_t *p = vma->vma_vmmap->vmm_proc;
+                if (NULL != p && p != last
+                    && pf->pf_pagenum >= vma->vma_off
+                    && pf->pf_pagenum < vma->vma_off + (vma->vma_end - vma->vma_start)) {
+                        p->p_rusage.ru_pageouts++;
+                        last = p;
+                }
+        } list_iterate_end();
+}
+
 /*
  * Just cancel pageoutd
  */
@@ -599,17 +751,28 @@ pageoutd_exit()
 static void *
 pageoutd_run(int arg1, void *arg2)
 {
+        mmobj_t *waitobj = NULL;        /* the page last waited for; */
+        uint32_t waitpage = 0;          /* its pframe may have been reused */
+
         while (1) {
                 KASSERT(nallocated >= 0);
                 while ((!pageoutd_target_met()) && (!list_empty(&alloc_list))) {
                         pframe_t *pf;
 
+                        sched_cond_resched();
+
                         /* obtain least-recently-requested page: */
                         pf = list_head(&alloc_list, pframe_t, pf_link);
 
                         if (pframe_is_busy(pf)) {
+                                if (pf->pf_obj == waitobj && pf->pf_pagenum == waitpage) {
+                                        sched_queue_spurious(&pf->pf_waitq);
+                                }
+                                waitobj = pf->pf_obj;
+                                waitpage = pf->pf_pagenum;
                                 sched_sleep_on(&pf->pf_waitq);
                         } else if (pframe_is_dirty(pf)) {
+                                pageoutd_account(pf);
                                 pframe_clean(pf);
                         } else {
                                 /* it's not busy, it's clean, and it's
@@ -618,7 +781,8 @@ pageoutd_run(int arg1, void *arg2)
                         }
                 }
 
-                /*   release the thundering herd... */
+                /* wake the first thread waiting for memory, which passes
+                 * the wakeup on to the next (see pframe_get) */
                 sched_broadcast_on(&alloc_waitq);
 
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Falling asleep\n");
@@ -0,0 +1,78 @@
+#include "types.h"
+#include "kernel.h"
+#include "config.h"
+
+#include "mm/page.h"
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
+
+#include "util/debug.h"
+
+void
+tlb_gather_init(tlb_gather_t *tg, pagedir_t *pd)
+{
+        KASSERT(NULL != pd);
+
+        tg->tg_pd = pd;
+        tg->tg_start = 0;
+        tg->tg_end = 0;
+        tg->tg_nfree = 0;
+}
+
+void
+tlb_gather_range(tlb_gather_t *tg, uintptr_t vlow, uintptr_t vhigh)
+{
+        KASSERT(PAGE_ALIGNED(vlow) && PAGE_ALIGNED(vhigh));
+        KASSERT(vlow < vhigh);
+
+        if (tg->tg_start == tg->tg_end) {
+                tg->tg_start = vlow;
+                tg->tg_end = vhigh;
+        } else {
+                tg->tg_start = MIN(tg->tg_start, vlow);
+                tg->tg_end = MAX(tg->tg_end, vhigh);
+        }
+}
+
+/* Does the invalidations collected so far and frees the queued pages,
+ * but keeps the range: the caller may still be clearing entries inside
+ * it, and those need invalidating by the next flush as well. */
+static void
+_tlb_gather_flush(tlb_gather_t *tg)
+{
+        uint32_t npages = (tg->tg_end - tg->tg_start) >> PAGE_SHIFT;
+
+        /* a page directory which is not loaded has nothing in the TLB */
+        if (0 < npages && pt_get() == tg->tg_pd) {
+                if (TLB_FLUSH_ALL_PAGES < npages) {
+                        tlb_flush_all();
+                } else {
+                        tlb_flush_range(tg->tg_start, npages);
+                }
+        }
+
+        uint32_t i;
+        for (i = 0; i < tg->tg_nfree; ++i) {
+                page_free(tg->tg_free[i]);
+        }
+        tg->tg_nfree = 0;
+}
+
+void
+tlb_gather_free(tlb_gather_t *tg, void *page)
+{
+        KASSERT(PAGE_ALIGNED(page));
+
+        if (TLB_GATHER_FREE == tg->tg_nfree) {
+                _tlb_gather_flush(tg);
+        }
+        tg->tg_free[tg->tg_nfree++] = page;
+}
+
+void
+tlb_gather_finish(tlb_gather_t *tg)
+{
+        _tlb_gather_flush(tg);
+        tg->tg_start = 0;
+        tg->tg_end = 0;
+}
@@ -11,6 +11,7 @@
 #include "mm/pagetable.h"
 
 #include "util/debug.h"
+#include "util/string.h"
 
 static void
 __context_initial_func(context_func_t func, int arg1, void *arg2)
@@ -34,6 +35,7 @@ context_setup(context_t *c, context_func_t func, int arg1, void *arg2,
         c->c_kstack = (uintptr_t)kstack;
         c->c_kstacksz = kstacksz;
         c->c_pdptr = pdptr;
+        memset(c->c_kmap, 0, sizeof(c->c_kmap));
 
         /* put the arguments for __contect_initial_func onto the
          * stack, leave room at the bottom of the stack for a phony
@@ -57,6 +59,7 @@ context_make_active(context_t *c)
 {
         gdt_set_kernel_stack((void *)((uintptr_t)c->c_kstack + c->c_kstacksz));
         pt_set(c->c_pdptr);
+        pt_kmap_load(c->c_kmap);
 
         /* Switch stacks and run the thread */
         __asm__ volatile(
@@ -73,6 +76,7 @@ context_switch(context_t *oldc, context_t *newc)
 {
         gdt_set_kernel_stack((void *)((uintptr_t)newc->c_kstack + newc->c_kstacksz));
         pt_set(newc->c_pdptr);
+        pt_kmap_load(newc->c_kmap);
 
         /*
          * Save the current value of the stack pointer and the frame pointer into
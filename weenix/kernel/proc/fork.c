@@ -48,6 +48,16 @@ fork_setup_stack(const regs_t *regs, void *kstack)
  * you're practically home free. This is what the
  * entirety of Weenix has been leading up to.
  * Go forth and conquer.
+ *
+ * Do not unmap the parent's page table to make its private mappings
+ * fault: once the shadow objects are set up, use vmmap_clone_ptes()
+ * to copy the parent's page table entries into the child with private
+ * mappings write-protected in both, then flush the parent's TLB. That
+ * way neither process has to fault its resident pages back in.
+ *
+ * Call vmmap_collapse() on the parent's map before putting the new
+ * shadow objects on top of its private areas, so that the chains stay
+ * bounded however many times a process forks.
  */
 int
 do_fork(struct regs *regs)
@@ -55,3 +65,67 @@ do_fork(struct regs *regs)
         NOT_YET_IMPLEMENTED("VM: do_fork");
         return 0;
 }
+
+/*
+ * The implementation of vfork(2). Unlike fork, nothing is copied: the
+ * child runs on its parent's vmmap and pagedir, and the parent sleeps
+ * until the child gives them back by calling execve or exiting (see
+ * proc_vfork_release()). The child's own map and page table, which
+ * proc_create() made, are set aside until then.
+ */
+int
+do_vfork(struct regs *regs)
+{
+        proc_t *child;
+        kthread_t *thr;
+        regs_t child_regs;
+        pid_t pid;
+        int fd;
+
+        KASSERT(NULL != regs);
+        KASSERT(NULL != curproc->p_vmmap && NULL != curproc->p_pagedir);
+
+        if (NULL == (thr = kthread_clone(curthr))) {
+                return -ENOMEM;
+        }
+        if (NULL == (child = proc_create(curproc->p_comm))) {
+                kthread_destroy(thr);
+                return -ENOMEM;
+        }
+        pid = child->p_pid;
+
+        /* proc_create() already gave the child our working directory */
+        for (fd = 0; fd < NFILES; fd++) {
+                if (NULL != (child->p_files[fd] = curproc->p_files[fd])) {
+                        fref(child->p_files[fd]);
+                }
+        }
+        child->p_brk = curproc->p_brk;
+        child->p_start_brk = curproc->p_start_brk;
+
+        child->p_vfork_vmmap = child->p_vmmap;
+        child->p_vfork_pagedir = child->p_pagedir;
+        child->p_vmmap = curproc->p_vmmap;
+        child->p_pagedir = curproc->p_pagedir;
+        child->p_vfork_parent = curproc;
+        sched_queue_init(&child->p_vfork_wait);
+
+        /* The child returns 0 from the same trap, on the same user stack */
+        child_regs = *regs;
+        child_regs.r_eax = 0;
+
+        thr->kt_proc = child;
+        list_insert_tail(&child->p_threads, &thr->kt_plink);
+        thr->kt_ctx.c_pdptr = child->p_pagedir;
+        thr->kt_ctx.c_eip = (uint32_t) userland_entry;
+        thr->kt_ctx.c_esp = fork_setup_stack(&child_regs, thr->kt_kstack);
+        thr->kt_ctx.c_kstack = (uintptr_t) thr->kt_kstack;
+        thr->kt_ctx.c_kstacksz = DEFAULT_STACK_SIZE;
+
+        sched_make_runnable(thr);
+        while (NULL != child->p_vfork_parent) {
+                sched_sleep_on(&child->p_vfork_wait);
+        }
+
+        return pid;
+}
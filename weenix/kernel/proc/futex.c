@@ -0,0 +1,172 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+
+#include "proc/futex.h"
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/slab.h"
+
+#include "vm/vmmap.h"
+
+#include "api/access.h"
+
+/*
+ * A futex is named by where the int it is at lives: in a private
+ * mapping, by the address space and the address; in a shared mapping,
+ * by the object mapped and the offset into it, so that processes
+ * sharing the mapping find the same futex wherever each has it mapped.
+ * A futex_t only exists while threads are waiting on it, on the list of
+ * its bucket of the hash table.
+ */
+typedef struct futex_key {
+        void           *fk_space;       /* the vmmap_t or the mmobj_t */
+        uint32_t        fk_offset;      /* the address or the offset */
+} futex_key_t;
+
+typedef struct futex {
+        futex_key_t     f_key;
+        ktqueue_t       f_waitq;
+        int             f_refcount;     /* threads waiting */
+        list_link_t     f_link;         /* link on its hash bucket */
+} futex_t;
+
+static list_t futex_hash[FUTEX_HASH_SIZE];
+static slab_allocator_t *futex_allocator;
+
+static __attribute__((unused)) void
+futex_init(void)
+{
+        int i;
+
+        for (i = 0; i < FUTEX_HASH_SIZE; ++i) {
+                list_init(&futex_hash[i]);
+        }
+        futex_allocator = slab_allocator_create("futex", sizeof(futex_t));
+        KASSERT(NULL != futex_allocator);
+}
+init_func(futex_init);
+
+static int
+futex_key(int *uaddr, futex_key_t *key)
+{
+        vmarea_t *vma;
+        uint32_t vfn = ADDR_TO_PN(uaddr);
+
+        if ((uintptr_t)uaddr & (sizeof(int) - 1)) {
+                return -EINVAL;
+        }
+        if (NULL == (vma = vmmap_lookup(curproc->p_vmmap, vfn))) {
+                return -EFAULT;
+        }
+
+        if (MAP_SHARED == (vma->vma_flags & MAP_TYPE)) {
+                key->fk_space = vma->vma_obj;
+                key->fk_offset = (uint32_t)PN_TO_ADDR(vma->vma_off + vfn - vma->vma_start)
+                                 + PAGE_OFFSET(uaddr);
+        } else {
+                key->fk_space = curproc->p_vmmap;
+                key->fk_offset = (uint32_t)uaddr;
+        }
+        return 0;
+}
+
+static list_t *
+futex_bucket(futex_key_t *key)
+{
+        return &futex_hash[(((uint32_t)key->fk_space >> 4) ^ (key->fk_offset >> 2))
+                           % FUTEX_HASH_SIZE];
+}
+
+static futex_t *
+futex_find(futex_key_t *key)
+{
+        futex_t *f;
+
+        list_iterate_begin(futex_bucket(key), f, futex_t, f_link) {
+                if (f->f_key.fk_space == key->fk_space
+                    && f->f_key.fk_offset == key->fk_offset) {
+                        return f;
+                }
+        } list_iterate_end();
+
+        return NULL;
+}
+
+static void
+futex_put(futex_t *f)
+{
+        KASSERT(0 < f->f_refcount);
+
+        if (0 == --f->f_refcount) {
+                KASSERT(sched_queue_empty(&f->f_waitq));
+                list_remove(&f->f_link);
+                slab_obj_free(futex_allocator, f);
+        }
+}
+
+int
+do_futex_wait(int *uaddr, int val)
+{
+        futex_key_t key;
+        futex_t *f;
+        int cur, err;
+
+        if ((err = futex_key(uaddr, &key)) < 0) {
+                return err;
+        }
+
+        if (NULL == (f = futex_find(&key))) {
+                if (NULL == (f = slab_obj_alloc(futex_allocator))) {
+                        return -ENOMEM;
+                }
+                f->f_key = key;
+                sched_queue_init(&f->f_waitq);
+                f->f_refcount = 0;
+                list_insert_tail(futex_bucket(&key), &f->f_link);
+        }
+        ++f->f_refcount;
+
+        /* A thread changes the int before it wakes the futex, and nothing
+         * between reading it and sleeping blocks, so no wakeup can be
+         * missed. One which comes while the read is blocked on a page
+         * fault finds no one to wake, but then the read sees the new
+         * value. */
+        if (copy_from_user(&cur, uaddr, sizeof(int)) < 0) {
+                err = -EFAULT;
+        } else if (cur != val) {
+                err = -EAGAIN;
+        } else {
+                err = sched_cancellable_sleep_on(&f->f_waitq);
+        }
+
+        futex_put(f);
+        return err;
+}
+
+int
+do_futex_wake(int *uaddr, int count)
+{
+        futex_key_t key;
+        futex_t *f;
+        int err, n = 0;
+
+        if ((err = futex_key(uaddr, &key)) < 0) {
+                return err;
+        }
+
+        if (NULL != (f = futex_find(&key))) {
+                while (n < count && NULL != sched_wakeup_on(&f->f_waitq)) {
+                        ++n;
+                }
+        }
+        return n;
+}
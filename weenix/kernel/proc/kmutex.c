@@ -2,9 +2,12 @@
 #include "errno.h"
 
 #include "util/debug.h"
+#include "util/init.h"
+#include "util/time.h"
 
 #include "proc/kthread.h"
 #include "proc/kmutex.h"
+#include "proc/proc.h"
 
 /*
  * IMPORTANT: Mutexes can _NEVER_ be locked or unlocked from an
@@ -12,15 +15,53 @@
  * thread context.
  */
 
+#ifdef __LOCKSTAT__
+/* the locks which have been waited for, in no particular order */
+static list_t kmutex_contended;
+
+static __attribute__((unused)) void
+kmutex_stat_list_init(void)
+{
+        list_init(&kmutex_contended);
+}
+init_func(kmutex_stat_list_init);
+#endif
+
+/*
+ * Besides the wait queue and the holder, kmutex_stat_init() must be
+ * called to clear the statistics.
+ */
 void
 kmutex_init(kmutex_t *mtx)
 {
         NOT_YET_IMPLEMENTED("PROCS: kmutex_init");
 }
 
+void
+kmutex_destroy(kmutex_t *mtx)
+{
+        KASSERT(NULL == mtx->km_holder);
+        KASSERT(sched_queue_empty(&mtx->km_waitq));
+
+#ifdef __LOCKSTAT__
+        lockstat_destroy(&mtx->km_stat);
+#endif
+}
+
 /*
  * This should block the current thread (by sleeping on the mutex's
- * wait queue) if the mutex is already taken.
+ * wait queue) if the mutex is already taken. Sleep as an exclusive
+ * waiter, with sched_sleep_on_exclusive(). The mutex is handed over
+ * by kmutex_unlock(): a thread which wakes up normally already holds
+ * it. A wakeup can also be spurious (see
+ * sched_cancellable_sleep_on_exclusive()), so on waking take the mutex
+ * if it is free, carry on if km_holder is the current thread, and
+ * otherwise count the wakeup with sched_queue_spurious() and sleep
+ * again.
+ *
+ * Call kmutex_stat_wait() just before sleeping, and
+ * kmutex_stat_acquire() once the mutex is held, whether or not the
+ * thread slept.
  *
  * No thread should ever try to lock a mutex it already has locked.
  */
@@ -32,7 +73,11 @@ kmutex_lock(kmutex_t *mtx)
 
 /*
  * This should do the same as kmutex_lock, but use a cancellable sleep
- * instead.
+ * (sched_cancellable_sleep_on_exclusive) instead. A thread can be
+ * cancelled after the mutex has been handed to it, but before it runs,
+ * so whether it holds the mutex is what matters, not what the sleep
+ * returned: only fail with -EINTR if km_holder is not the current
+ * thread.
  */
 int
 kmutex_lock_cancellable(kmutex_t *mtx)
@@ -51,7 +96,13 @@ kmutex_lock_cancellable(kmutex_t *mtx)
  * run queue.
  *
  * Note: Make sure that the thread on the head of the mutex's wait
- * queue becomes the new owner of the mutex.
+ * queue becomes the new owner of the mutex. Set km_holder to it
+ * before it runs, rather than leaving the mutex free for it to take
+ * when it does: otherwise a thread which comes along in between could
+ * take the mutex first, and the waiter would have to wait again.
+ * sched_wakeup_on() returns the thread it woke.
+ *
+ * Call kmutex_stat_release() before giving up the mutex.
  *
  * @param mtx the mutex to unlock
  */
@@ -60,3 +111,132 @@ kmutex_unlock(kmutex_t *mtx)
 {
         NOT_YET_IMPLEMENTED("PROCS: kmutex_unlock");
 }
+
+#ifdef __LOCKSTAT__
+void
+kmutex_setname(kmutex_t *mtx, const char *name)
+{
+        mtx->km_stat.ks_name = name;
+}
+
+void
+kmutex_stat_init(kmutex_t *mtx)
+{
+        lockstat_init(&mtx->km_stat, mtx);
+}
+
+uint64_t
+kmutex_stat_wait(kmutex_t *mtx)
+{
+        KASSERT(NULL != mtx->km_holder && curthr != mtx->km_holder);
+
+        return lockstat_wait(&mtx->km_stat, mtx->km_holder);
+}
+
+void
+kmutex_stat_acquire(kmutex_t *mtx, uint64_t since)
+{
+        KASSERT(curthr == mtx->km_holder);
+
+        lockstat_acquire(&mtx->km_stat, since);
+}
+
+void
+kmutex_stat_release(kmutex_t *mtx)
+{
+        KASSERT(curthr == mtx->km_holder);
+
+        lockstat_release(&mtx->km_stat);
+}
+
+void
+lockstat_init(kmutex_stat_t *ks, const void *lock)
+{
+        ks->ks_lock = lock;
+        ks->ks_name = NULL;
+        ks->ks_acquired = 0;
+        ks->ks_contended = 0;
+        ks->ks_wait_total = 0;
+        ks->ks_wait_max = 0;
+        ks->ks_hold_total = 0;
+        ks->ks_hold_max = 0;
+        ks->ks_held_since = 0;
+        ks->ks_last_holder = -1;
+        list_link_init(&ks->ks_link);
+}
+
+uint64_t
+lockstat_wait(kmutex_stat_t *ks, struct kthread *holder)
+{
+        if (NULL != holder) {
+                ks->ks_last_holder = holder->kt_proc->p_pid;
+        }
+        if (!list_link_is_linked(&ks->ks_link)) {
+                list_insert_tail(&kmutex_contended, &ks->ks_link);
+        }
+        return rdtsc();
+}
+
+void
+lockstat_acquire(kmutex_stat_t *ks, uint64_t since)
+{
+        uint64_t now = rdtsc();
+
+        ++ks->ks_acquired;
+        if (0 != since) {
+                ++ks->ks_contended;
+                ks->ks_wait_total += now - since;
+                if (now - since > ks->ks_wait_max) {
+                        ks->ks_wait_max = now - since;
+                }
+        }
+        ks->ks_held_since = now;
+}
+
+void
+lockstat_release(kmutex_stat_t *ks)
+{
+        uint64_t held = rdtsc() - ks->ks_held_since;
+
+        ks->ks_hold_total += held;
+        if (held > ks->ks_hold_max) {
+                ks->ks_hold_max = held;
+        }
+}
+
+void
+lockstat_destroy(kmutex_stat_t *ks)
+{
+        if (list_link_is_linked(&ks->ks_link)) {
+                list_remove(&ks->ks_link);
+        }
+}
+
+/*
+ * Picks the most contended locks by insertion into 'stats', which is
+ * kept sorted. The list is short: only locks which have been waited
+ * for are on it.
+ */
+int
+kmutex_stat_top(kmutex_stat_t *stats, int max)
+{
+        kmutex_stat_t *ks;
+        int n = 0, i;
+
+        list_iterate_begin(&kmutex_contended, ks, kmutex_stat_t, ks_link) {
+                for (i = n; i > 0 && stats[i - 1].ks_contended < ks->ks_contended; --i) {
+                        if (i < max) {
+                                stats[i] = stats[i - 1];
+                        }
+                }
+                if (i < max) {
+                        stats[i] = *ks;
+                        if (n < max) {
+                                ++n;
+                        }
+                }
+        } list_iterate_end();
+
+        return n;
+}
+#endif
@@ -0,0 +1,171 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+
+#include "proc/kthread.h"
+#include "proc/krwlock.h"
+
+/*
+ * As with mutexes, a writer which has waited does not take the lock
+ * when it wakes up: whoever unlocked it already made it the writer, so
+ * that no thread can slip in between. krw_wwaiting counts the writers
+ * which have gone to sleep and not yet run again, which keeps new
+ * readers out until they have all had the lock. Readers are not handed
+ * the lock. They are all woken once no writer wants it, and check
+ * again.
+ */
+
+void
+krwlock_init(krwlock_t *lock)
+{
+        sched_queue_init(&lock->krw_readq);
+        sched_queue_init(&lock->krw_writeq);
+        lock->krw_readers = 0;
+        lock->krw_wwaiting = 0;
+        lock->krw_writer = NULL;
+#ifdef __LOCKSTAT__
+        lockstat_init(&lock->krw_stat, lock);
+#endif
+}
+
+void
+krwlock_destroy(krwlock_t *lock)
+{
+        KASSERT(NULL == lock->krw_writer && 0 == lock->krw_readers);
+        KASSERT(sched_queue_empty(&lock->krw_readq));
+        KASSERT(sched_queue_empty(&lock->krw_writeq));
+
+#ifdef __LOCKSTAT__
+        lockstat_destroy(&lock->krw_stat);
+#endif
+}
+
+#ifdef __LOCKSTAT__
+void
+krwlock_setname(krwlock_t *lock, const char *name)
+{
+        lock->krw_stat.ks_name = name;
+}
+#endif
+
+static int
+krwlock_read_acquire(krwlock_t *lock, int cancellable)
+{
+        uint64_t since = 0;
+
+        KASSERT(curthr != lock->krw_writer);
+
+        while (NULL != lock->krw_writer || 0 < lock->krw_wwaiting) {
+#ifdef __LOCKSTAT__
+                if (0 == since) {
+                        since = lockstat_wait(&lock->krw_stat, lock->krw_writer);
+                }
+#endif
+                if (cancellable) {
+                        if (sched_cancellable_sleep_on(&lock->krw_readq)) {
+                                return -EINTR;
+                        }
+                } else {
+                        sched_sleep_on(&lock->krw_readq);
+                }
+        }
+
+        ++lock->krw_readers;
+#ifdef __LOCKSTAT__
+        lockstat_acquire(&lock->krw_stat, since);
+#endif
+        return 0;
+}
+
+void
+krwlock_read_lock(krwlock_t *lock)
+{
+        krwlock_read_acquire(lock, 0);
+}
+
+int
+krwlock_read_lock_cancellable(krwlock_t *lock)
+{
+        return krwlock_read_acquire(lock, 1);
+}
+
+void
+krwlock_read_unlock(krwlock_t *lock)
+{
+        KASSERT(0 < lock->krw_readers);
+        KASSERT(NULL == lock->krw_writer);
+
+        if (0 == --lock->krw_readers) {
+                lock->krw_writer = sched_wakeup_on(&lock->krw_writeq);
+        }
+}
+
+static int
+krwlock_write_acquire(krwlock_t *lock, int cancellable)
+{
+        uint64_t since = 0;
+
+        KASSERT(curthr != lock->krw_writer);
+
+        if (NULL == lock->krw_writer && 0 == lock->krw_readers) {
+                lock->krw_writer = curthr;
+#ifdef __LOCKSTAT__
+                lockstat_acquire(&lock->krw_stat, 0);
+#endif
+                return 0;
+        }
+
+#ifdef __LOCKSTAT__
+        since = lockstat_wait(&lock->krw_stat, lock->krw_writer);
+#endif
+        ++lock->krw_wwaiting;
+        if (cancellable) {
+                sched_cancellable_sleep_on(&lock->krw_writeq);
+        } else {
+                sched_sleep_on(&lock->krw_writeq);
+        }
+        --lock->krw_wwaiting;
+
+        /* The thread may have been cancelled after the lock was handed
+         * to it, in which case it has the lock all the same. */
+        if (curthr == lock->krw_writer) {
+#ifdef __LOCKSTAT__
+                lockstat_acquire(&lock->krw_stat, since);
+#endif
+                return 0;
+        }
+        KASSERT(cancellable);
+
+        /* let in the readers which were held off for this thread */
+        if (NULL == lock->krw_writer && 0 == lock->krw_wwaiting) {
+                sched_broadcast_on(&lock->krw_readq);
+        }
+        return -EINTR;
+}
+
+void
+krwlock_write_lock(krwlock_t *lock)
+{
+        krwlock_write_acquire(lock, 0);
+}
+
+int
+krwlock_write_lock_cancellable(krwlock_t *lock)
+{
+        return krwlock_write_acquire(lock, 1);
+}
+
+void
+krwlock_write_unlock(krwlock_t *lock)
+{
+        KASSERT(curthr == lock->krw_writer);
+        KASSERT(0 == lock->krw_readers);
+
+#ifdef __LOCKSTAT__
+        lockstat_release(&lock->krw_stat);
+#endif
+        if (NULL == (lock->krw_writer = sched_wakeup_on(&lock->krw_writeq))) {
+                sched_broadcast_on(&lock->krw_readq);
+        }
+}
@@ -70,6 +70,10 @@ free_stack(char *stack)
  * Don't forget to initialize the thread context with the
  * context_setup function. The context should have the same pagetable
  * pointer as the process.
+ *
+ * kt_level, kt_ticks, kt_resched, kt_npreempt, kt_exclusive and
+ * kt_timedout start out at 0; the scheduler moves the thread into its
+ * process's band of the run queue.
  */
 kthread_t *
 kthread_create(struct proc *p, kthread_func_t func, long arg1, void *arg2)
@@ -125,7 +129,9 @@ kthread_exit(void *retval)
 /*
  * The new thread will need its own context and stack. Think carefully
  * about which fields should be copied and which fields should be
- * freshly initialized.
+ * freshly initialized. (The clone keeps the run queue level of thr,
+ * but starts a fresh slice: kt_ticks, kt_resched and kt_npreempt are
+ * 0.)
  *
  * You do not need to worry about this until VM.
  */
@@ -78,6 +78,15 @@ failed:
  * Don't forget to set proc_initproc when you create the init
  * process. You will need to be able to reference the init process
  * when reparenting processes to the init process.
+ *
+ * A new process is not a vfork child: p_vfork_parent and the two
+ * p_vfork_* fields must start out NULL.
+ *
+ * Its p_rusage counters start out at zero; they are not inherited
+ * across fork(2). Its resource limits (p_rlimit), however, are
+ * inherited from curproc, or are all RLIM_INFINITY if there is no
+ * current process yet, and so is p_nice (or 0). p_rss_charged starts
+ * at 0.
  */
 proc_t *
 proc_create(char *name)
@@ -86,6 +95,25 @@ proc_create(char *name)
         return NULL;
 }
 
+void
+proc_destroy(proc_t *p)
+{
+        KASSERT(list_empty(&p->p_threads));
+        KASSERT(list_empty(&p->p_children));
+        KASSERT(NULL == p->p_vfork_parent);
+
+        list_remove(&p->p_list_link);
+        list_remove(&p->p_child_link);
+#ifdef __VFS__
+        if (NULL != p->p_cwd) {
+                vput(p->p_cwd);
+        }
+#endif
+        vmmap_destroy(p->p_vmmap);
+        pt_destroy_pagedir(p->p_pagedir);
+        slab_obj_free(proc_allocator, p);
+}
+
 /**
  * Cleans up as much as the process as can be done from within the
  * process. This involves:
@@ -108,6 +136,11 @@ proc_create(char *name)
  * Note: You do _NOT_ have to special case the idle process. It should
  * never exit this way.
  *
+ * A vfork child that exits without calling execve is still using its
+ * parent's vmmap and pagedir. Call proc_vfork_release() before cleaning
+ * up the VM mappings so that it is its own (empty) map that gets torn
+ * down, and so that the parent resumes.
+ *
  * @param status the status to exit the process with
  */
 void
@@ -116,6 +149,37 @@ proc_cleanup(int status)
         NOT_YET_IMPLEMENTED("PROCS: proc_cleanup");
 }
 
+void
+proc_vfork_release(proc_t *p)
+{
+        kthread_t *thr;
+
+        if (NULL == p->p_vfork_parent) {
+                return;
+        }
+        KASSERT(p->p_vmmap == p->p_vfork_parent->p_vmmap);
+        KASSERT(p->p_pagedir == p->p_vfork_parent->p_pagedir);
+
+        p->p_vmmap = p->p_vfork_vmmap;
+        p->p_pagedir = p->p_vfork_pagedir;
+        p->p_vfork_vmmap = NULL;
+        p->p_vfork_pagedir = NULL;
+        p->p_vfork_parent = NULL;
+
+        list_iterate_begin(&p->p_threads, thr, kthread_t, kt_plink) {
+                thr->kt_ctx.c_pdptr = p->p_pagedir;
+        } list_iterate_end();
+
+        /* The return to userland after execve does not go through
+         * userland_entry, so switch off the parent's page table here */
+        if (p == curproc) {
+                pt_set(p->p_pagedir);
+                pt_set_user(p->p_pagedir);
+        }
+
+        sched_wakeup_on(&p->p_vfork_wait);
+}
+
 /*
  * This has nothing to do with signals and kill(1).
  *
@@ -208,6 +272,115 @@ do_exit(int status)
         NOT_YET_IMPLEMENTED("PROCS: do_exit");
 }
 
+void
+proc_rusage(proc_t *p, struct rusage *ru)
+{
+        *ru = p->p_rusage;
+        ru->ru_anonrss = 0;
+        ru->ru_shadowrss = 0;
+        ru->ru_filerss = 0;
+        if (NULL != p->p_vmmap) {
+                vmmap_rss(p->p_vmmap, ru);
+        }
+}
+
+static uint32_t
+proc_rss(proc_t *p)
+{
+        struct rusage ru;
+
+        proc_rusage(p, &ru);
+        return ru.ru_anonrss + ru.ru_shadowrss + ru.ru_filerss;
+}
+
+int
+proc_charge_rss(proc_t *p, uint32_t npages)
+{
+        rlim_t limit = p->p_rlimit[RLIMIT_RSS].rlim_cur;
+        uint32_t maxpages, rss;
+
+        if (RLIM_INFINITY == limit) {
+                return 0;
+        }
+        maxpages = limit / PAGE_SIZE;
+
+        /* p_rss_charged only ever counts high (pages freed or unmapped
+         * since it was last worked out are still in it), so the real
+         * count is only needed once it reaches the limit */
+        if (p->p_rss_charged + npages > maxpages) {
+                if (npages > maxpages) {
+                        return -ENOMEM;
+                }
+                rss = proc_rss(p);
+                if (rss + npages > maxpages && NULL != p->p_vmmap) {
+                        vmmap_reclaim(p->p_vmmap, rss + npages - maxpages);
+                        rss = proc_rss(p);
+                }
+                p->p_rss_charged = rss;
+                if (rss + npages > maxpages) {
+                        dbg(DBG_VM, "process %d (%s) is over its rss limit of %u pages\n",
+                            p->p_pid, p->p_comm, maxpages);
+                        return -ENOMEM;
+                }
+        }
+
+        p->p_rss_charged += npages;
+        return 0;
+}
+
+int
+do_getrlimit(int resource, struct rlimit *rlim)
+{
+        if (0 > resource || RLIM_NLIMITS <= resource) {
+                return -EINVAL;
+        }
+
+        *rlim = curproc->p_rlimit[resource];
+        return 0;
+}
+
+int
+do_setrlimit(int resource, const struct rlimit *rlim)
+{
+        if (0 > resource || RLIM_NLIMITS <= resource
+            || rlim->rlim_cur > rlim->rlim_max) {
+                return -EINVAL;
+        }
+        if (rlim->rlim_max > curproc->p_rlimit[resource].rlim_max) {
+                return -EPERM;
+        }
+
+        curproc->p_rlimit[resource] = *rlim;
+        if (RLIMIT_RSS == resource) {
+                /* start counting again from the real number */
+                curproc->p_rss_charged = proc_rss(curproc);
+        }
+        return 0;
+}
+
+int
+do_nice(int incr)
+{
+        curproc->p_nice = MIN(MAX(curproc->p_nice + incr, NICE_MIN), NICE_MAX);
+        return curproc->p_nice;
+}
+
+int
+do_getrusage(int who, struct rusage *ru)
+{
+        proc_t *p = curproc;
+
+        if (0 > who) {
+                return -EINVAL;
+        }
+        if (RUSAGE_SELF != who && NULL == (p = proc_lookup(who))) {
+                return -ESRCH;
+        }
+
+        proc_rusage(p, ru);
+        return 0;
+}
+
 size_t
 proc_info(const void *arg, char *buf, size_t osize)
 {
@@ -236,6 +409,12 @@ proc_info(const void *arg, char *buf, size_t osize)
         iprintf(&buf, &size, "thread count: %i\n", count);
 #endif
 
+        kthread_t *thr;
+        list_iterate_begin(&p->p_threads, thr, kthread_t, kt_plink) {
+                iprintf(&buf, &size, "thread:       0x%p (level %i, preempted %u times)\n",
+                        thr, thr->kt_level, thr->kt_npreempt);
+        } list_iterate_end();
+
         if (list_empty(&p->p_children)) {
                 iprintf(&buf, &size, "children:     -\n");
         } else {
@@ -247,6 +426,12 @@ proc_info(const void *arg, char *buf, size_t osize)
 
         iprintf(&buf, &size, "status:       %i\n", p->p_status);
         iprintf(&buf, &size, "state:        %i\n", p->p_state);
+        iprintf(&buf, &size, "nice:         %i\n", p->p_nice);
+        if (NULL != p->p_pagedir) {
+                iprintf(&buf, &size, "page tables:  %u (%uKB)\n",
+                        pt_user_tables(p->p_pagedir),
+                        pt_user_tables(p->p_pagedir) * PAGE_SIZE / 1024);
+        }
 
 #ifdef __VFS__
 #ifdef __GETCWD__
@@ -263,6 +448,19 @@ proc_info(const void *arg, char *buf, size_t osize)
 #ifdef __VM__
         iprintf(&buf, &size, "start brk:    0x%p\n", p->p_start_brk);
         iprintf(&buf, &size, "brk:          0x%p\n", p->p_brk);
+
+        struct rusage ru;
+        proc_rusage((proc_t *)p, &ru);
+        iprintf(&buf, &size, "resident:     %lu anon, %lu shadow, %lu file\n",
+                ru.ru_anonrss, ru.ru_shadowrss, ru.ru_filerss);
+        iprintf(&buf, &size, "faults:       %lu minor, %lu major\n",
+                ru.ru_minflt, ru.ru_majflt);
+        iprintf(&buf, &size, "paging:       %lu in, %lu out\n",
+                ru.ru_pageins, ru.ru_pageouts);
+        if (RLIM_INFINITY != p->p_rlimit[RLIMIT_RSS].rlim_cur) {
+                iprintf(&buf, &size, "rss limit:    %luKB\n",
+                        p->p_rlimit[RLIMIT_RSS].rlim_cur / 1024);
+        }
 #endif
 
         return size;
@@ -5,16 +5,37 @@
 
 #include "proc/sched.h"
 #include "proc/kthread.h"
+#include "proc/proc.h"
 
 #include "util/init.h"
 #include "util/debug.h"
+#include "util/bits.h"
+#include "util/timer.h"
 
-static ktqueue_t kt_runq;
+/*
+ * The run queue is a multi-level feedback queue: one queue per level,
+ * and a bitmap of the levels which have threads on them, so that the
+ * highest (lowest numbered) one is found in constant time. A process's
+ * nice value picks a band of SCHED_FEEDBACK_LEVELS levels. Its threads
+ * start at the top of the band, drop a level each time they use up a
+ * slice (sched_tick) and climb one each time they are woken from a
+ * sleep (sched_boost).
+ */
+#define SCHED_LEVELS    (SCHED_NICE_LEVELS + SCHED_FEEDBACK_LEVELS - 1)
+
+static ktqueue_t kt_runq[SCHED_LEVELS];
+static uint32_t kt_runq_levels; /* bit n set if kt_runq[n] is not empty */
+static int sched_boost_ticks;   /* ticks since every thread was boosted */
 
 static __attribute__((unused)) void
 sched_init(void)
 {
-        sched_queue_init(&kt_runq);
+        int i;
+
+        for (i = 0; i < SCHED_LEVELS; ++i) {
+                sched_queue_init(&kt_runq[i]);
+        }
+        kt_runq_levels = 0;
 }
 init_func(sched_init);
 
@@ -76,12 +97,158 @@ ktqueue_remove(ktqueue_t *q, kthread_t *thr)
         q->tq_size--;
 }
 
+/*** PRIVATE RUN QUEUE MANIPULATION FUNCTIONS ***/
+/**
+ * Returns the top level of the band the thread's process is in.
+ */
+static int
+sched_band(kthread_t *thr)
+{
+        return (thr->kt_proc->p_nice - NICE_MIN) * SCHED_NICE_LEVELS
+               / (NICE_MAX - NICE_MIN + 1);
+}
+
+/**
+ * Puts a runnable thread on the run queue at its level, first moving
+ * it into its process's band if the nice value of the process has
+ * changed. Interrupts must be blocked.
+ *
+ * @param thr the thread to enqueue
+ */
+static __attribute__((unused)) void
+sched_runq_enqueue(kthread_t *thr)
+{
+        int top = sched_band(thr);
+
+        if (thr->kt_level < top || thr->kt_level >= top + SCHED_FEEDBACK_LEVELS) {
+                thr->kt_level = MIN(MAX(thr->kt_level, top), top + SCHED_FEEDBACK_LEVELS - 1);
+                thr->kt_ticks = 0;
+        }
+
+        ktqueue_enqueue(&kt_runq[thr->kt_level], thr);
+        kt_runq_levels |= 1 << thr->kt_level;
+}
+
+/**
+ * Takes the next thread to run off the run queue: the one which has
+ * waited longest on the highest level with any threads. Interrupts
+ * must be blocked.
+ *
+ * @return the thread, or NULL if the run queue is empty
+ */
+static __attribute__((unused)) kthread_t *
+sched_runq_dequeue(void)
+{
+        int level;
+        kthread_t *thr;
+
+        if (0 == kt_runq_levels) {
+                return NULL;
+        }
+
+        level = bit_first_set(kt_runq_levels);
+        thr = ktqueue_dequeue(&kt_runq[level]);
+        if (sched_queue_empty(&kt_runq[level])) {
+                kt_runq_levels &= ~(1 << level);
+        }
+        thr->kt_resched = 0;
+        return thr;
+}
+
+/**
+ * Moves every thread on the run queue back to the top of its band, so
+ * that those at the bottom of a band are not starved for good.
+ * Interrupts must be blocked.
+ */
+static void
+sched_runq_boost_all(void)
+{
+        int level;
+        kthread_t *thr;
+
+        for (level = 0; level < SCHED_LEVELS; ++level) {
+                list_iterate_begin(&kt_runq[level].tq_list, thr, kthread_t, kt_qlink) {
+                        int top = sched_band(thr);
+                        if (thr->kt_level > top) {
+                                ktqueue_remove(&kt_runq[level], thr);
+                                thr->kt_level = top;
+                                thr->kt_ticks = 0;
+                                sched_runq_enqueue(thr);
+                        }
+                } list_iterate_end();
+                if (sched_queue_empty(&kt_runq[level])) {
+                        kt_runq_levels &= ~(1 << level);
+                }
+        }
+}
+
+/*** PUBLIC RUN QUEUE PRIORITY FUNCTIONS ***/
+void
+sched_boost(kthread_t *thr)
+{
+        if (thr->kt_level > sched_band(thr)) {
+                --thr->kt_level;
+        }
+        thr->kt_ticks = 0;
+}
+
+int
+sched_tick(void)
+{
+        kthread_t *thr = curthr;
+        int top;
+
+        if (++sched_boost_ticks >= SCHED_BOOST_TICKS) {
+                sched_boost_ticks = 0;
+                sched_runq_boost_all();
+                if (NULL != thr) {
+                        thr->kt_level = sched_band(thr);
+                        thr->kt_ticks = 0;
+                }
+        }
+
+        if (NULL == thr) {
+                return 0;
+        }
+
+        top = sched_band(thr);
+        if (++thr->kt_ticks < SCHED_SLICE_TICKS << (thr->kt_level - top)) {
+                return 0;
+        }
+        if (thr->kt_level < top + SCHED_FEEDBACK_LEVELS - 1) {
+                ++thr->kt_level;
+        }
+        thr->kt_ticks = 0;
+        return 1;
+}
+
+void
+sched_preempt(void)
+{
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        ++curthr->kt_npreempt;
+        sched_make_runnable(curthr);
+        sched_switch();
+        intr_setipl(oldipl);
+}
+
+void
+sched_cond_resched(void)
+{
+        if (curthr->kt_resched) {
+                sched_preempt();
+        }
+}
+
 /*** PUBLIC KTQUEUE MANIPULATION FUNCTIONS ***/
 void
 sched_queue_init(ktqueue_t *q)
 {
         list_init(&q->tq_list);
         q->tq_size = 0;
+        q->tq_nspurious = 0;
 }
 
 int
@@ -118,6 +285,112 @@ sched_cancellable_sleep_on(ktqueue_t *q)
         return 0;
 }
 
+void
+sched_sleep_on_exclusive(ktqueue_t *q)
+{
+        curthr->kt_exclusive = 1;
+        sched_sleep_on(q);
+        curthr->kt_exclusive = 0;
+}
+
+int
+sched_cancellable_sleep_on_exclusive(ktqueue_t *q)
+{
+        int ret;
+
+        curthr->kt_exclusive = 1;
+        ret = sched_cancellable_sleep_on(q);
+        curthr->kt_exclusive = 0;
+
+        /* we may have been the one exclusive waiter a wakeup picked */
+        if (0 > ret) {
+                sched_wakeup_on(q);
+        }
+        return ret;
+}
+
+/*
+ * Called by the timer of a timed sleep: takes the thread off the queue
+ * it sleeps on unless something has woken it already. kt_wchan alone
+ * does not tell: a woken or cancelled thread waiting to run is on a run
+ * queue, which sets it too.
+ */
+static void
+sched_sleep_timeout(void *arg)
+{
+        kthread_t *thr = arg;
+
+        if (KT_SLEEP == thr->kt_state || KT_SLEEP_CANCELLABLE == thr->kt_state) {
+                KASSERT(NULL != thr->kt_wchan);
+                thr->kt_timedout = 1;
+                ktqueue_remove(thr->kt_wchan, thr);
+                sched_boost(thr);
+                sched_make_runnable(thr);
+        }
+}
+
+/*
+ * The timer is armed with interrupts blocked, so it cannot go off
+ * before the thread is on the queue.
+ */
+int
+sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks)
+{
+        ktimer_t timer;
+        uint8_t oldipl;
+
+        ktimer_init(&timer, sched_sleep_timeout, curthr);
+        curthr->kt_timedout = 0;
+
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        ktimer_arm(&timer, ticks);
+        sched_sleep_on(q);
+        ktimer_cancel(&timer);
+        intr_setipl(oldipl);
+
+        return curthr->kt_timedout ? -ETIMEDOUT : 0;
+}
+
+int
+sched_cancellable_sleep_on_timeout(ktqueue_t *q, uint32_t ticks)
+{
+        ktimer_t timer;
+        uint8_t oldipl;
+        int ret;
+
+        ktimer_init(&timer, sched_sleep_timeout, curthr);
+        curthr->kt_timedout = 0;
+
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        ktimer_arm(&timer, ticks);
+        ret = sched_cancellable_sleep_on(q);
+        ktimer_cancel(&timer);
+        intr_setipl(oldipl);
+
+        if (0 == ret && curthr->kt_timedout) {
+                ret = -ETIMEDOUT;
+        }
+        return ret;
+}
+
+void
+sched_queue_spurious(ktqueue_t *q)
+{
+        q->tq_nspurious++;
+        dbg(DBG_SCHED, "thread %p woken from queue %p for nothing (%u times)\n",
+            curthr, q, q->tq_nspurious);
+}
+
+/*
+ * Call sched_boost() on each thread woken here and in
+ * sched_broadcast_on() before making it runnable, so that threads which
+ * mostly sleep run ahead of those which use up their slices.
+ *
+ * This wakes the thread which has waited longest whether or not it is
+ * an exclusive waiter (kt_exclusive).
+ */
 kthread_t *
 sched_wakeup_on(ktqueue_t *q)
 {
@@ -125,6 +398,10 @@ sched_wakeup_on(ktqueue_t *q)
         return NULL;
 }
 
+/*
+ * Wake up every thread on the queue, oldest first, except exclusive
+ * waiters (kt_exclusive) after the first: those stay on the queue.
+ */
 void
 sched_broadcast_on(ktqueue_t *q)
 {
@@ -157,8 +434,8 @@ sched_cancel(struct kthread *kthr)
  * high.
  *
  * Once you have masked interrupts, you need to remove a thread from
- * the run queue and switch into its context from the currently
- * executing context.
+ * the run queue (with sched_runq_dequeue) and switch into its context
+ * from the currently executing context.
  *
  * If there are no threads on the run queue (assuming you do not have
  * any bugs), then all kernel threads are waiting for an interrupt
@@ -168,7 +445,9 @@ sched_cancel(struct kthread *kthr)
  * gets put on the run queue from the interrupt context.
  *
  * The proper way to do this is with the intr_wait call. See
- * interrupt.h for more details on intr_wait.
+ * interrupt.h for more details on intr_wait. Call time_idle_enter()
+ * before each intr_wait and time_idle_exit() after it, so that the
+ * clock does not tick while there is nothing to run.
  *
  * Note: When waiting for an interrupt, don't forget to modify the
  * IPL. If the IPL of the currently executing thread masks the
@@ -200,6 +479,8 @@ sched_switch(void)
  * modifying the IPL in this case. However, in some cases, we may want
  * more fine grained control, making modifying the IPL more
  * suitable. We modify the IPL here for consistency.
+ *
+ * Put the thread on the run queue with sched_runq_enqueue.
  */
 void
 sched_make_runnable(kthread_t *thr)
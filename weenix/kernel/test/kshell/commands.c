@@ -11,6 +11,9 @@
 #include "fs/vnode.h"
 #endif
 
+#include "proc/kmutex.h"
+#include "proc/proc.h"
+
 #include "test/kshell/io.h"
 
 #include "util/debug.h"
@@ -60,6 +63,64 @@ int kshell_echo(kshell_t *ksh, int argc, char **argv)
         return 0;
 }
 
+int kshell_rusage(kshell_t *ksh, int argc, char **argv)
+{
+        proc_t *p;
+        struct rusage ru;
+
+        kprintf(ksh, "%5s %-13s %7s %7s %7s %7s %7s %7s %7s\n", "PID", "NAME",
+                "ANON", "SHADOW", "FILE", "MINFLT", "MAJFLT", "PGIN", "PGOUT");
+        list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                proc_rusage(p, &ru);
+                kprintf(ksh, " %3i  %-13s %7lu %7lu %7lu %7lu %7lu %7lu %7lu\n",
+                        p->p_pid, p->p_comm, ru.ru_anonrss, ru.ru_shadowrss,
+                        ru.ru_filerss, ru.ru_minflt, ru.ru_majflt,
+                        ru.ru_pageins, ru.ru_pageouts);
+        } list_iterate_end();
+
+        return 0;
+}
+
+#ifdef __LOCKSTAT__
+#define LOCKSTAT_TOP 10
+
+/* Times are in cycles; the averages are per acquisition and per
+ * contended acquisition. */
+int kshell_lockstat(kshell_t *ksh, int argc, char **argv)
+{
+        kmutex_stat_t stats[LOCKSTAT_TOP];
+        proc_t *p;
+        int n, i;
+
+        /* copied out first, as printing can block and let locks be
+         * freed */
+        n = kmutex_stat_top(stats, LOCKSTAT_TOP);
+
+        kprintf(ksh, "%-10s %-10s %7s %7s %10s %10s %10s %10s %s\n", "NAME",
+                "LOCK", "ACQ", "CONT", "WAITAVG", "WAITMAX", "HOLDAVG",
+                "HOLDMAX", "LASTHOLDER");
+        for (i = 0; i < n; ++i) {
+                kmutex_stat_t *ks = &stats[i];
+
+                kprintf(ksh, "%-10s 0x%.8x %7u %7u %10llu %10llu %10llu %10llu",
+                        NULL == ks->ks_name ? "?" : ks->ks_name,
+                        (uint32_t)ks->ks_lock, ks->ks_acquired,
+                        ks->ks_contended,
+                        ks->ks_contended ? ks->ks_wait_total / ks->ks_contended : 0,
+                        ks->ks_wait_max,
+                        ks->ks_acquired ? ks->ks_hold_total / ks->ks_acquired : 0,
+                        ks->ks_hold_max);
+                if (NULL != (p = proc_lookup(ks->ks_last_holder))) {
+                        kprintf(ksh, " %i (%s)\n", p->p_pid, p->p_comm);
+                } else {
+                        kprintf(ksh, " %i\n", ks->ks_last_holder);
+                }
+        }
+
+        return 0;
+}
+#endif
+
 #ifdef __VFS__
 int kshell_cat(kshell_t *ksh, int argc, char **argv)
 {
@@ -8,6 +8,10 @@
 KSHELL_CMD(help);
 KSHELL_CMD(exit);
 KSHELL_CMD(echo);
+KSHELL_CMD(rusage);
+#ifdef __LOCKSTAT__
+KSHELL_CMD(lockstat);
+#endif
 #ifdef __VFS__
 KSHELL_CMD(cat);
 KSHELL_CMD(ls);
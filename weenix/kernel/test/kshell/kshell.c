@@ -21,6 +21,7 @@
 #endif
 
 #include "test/kshell/io.h"
+#include "test/sleeptest.h"
 
 #include "util/init.h"
 #include "util/debug.h"
@@ -34,6 +35,14 @@ static __attribute__((unused)) void kshell_init()
         kshell_add_command("help", kshell_help,
                            "prints a list of available commands");
         kshell_add_command("echo", kshell_echo, "display a line of text");
+        kshell_add_command("rusage", kshell_rusage,
+                           "display the memory usage of each process");
+        kshell_add_command("sleeptest", sleeptest_main,
+                           "cancel threads sleeping in nanosleep");
+#ifdef __LOCKSTAT__
+        kshell_add_command("lockstat", kshell_lockstat,
+                           "display the most contended locks");
+#endif
 #ifdef __VFS__
         kshell_add_command("cat", kshell_cat,
                            "concatenate files and print on the standard output");
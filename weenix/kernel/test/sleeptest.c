@@ -0,0 +1,103 @@
+#include "kernel.h"
+#include "errno.h"
+#include "globals.h"
+#include "config.h"
+
+#include "api/time.h"
+
+#include "main/interrupt.h"
+
+#include "proc/kthread.h"
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#include "test/sleeptest.h"
+#include "test/usertest.h"
+
+#include "util/debug.h"
+#include "util/time.h"
+
+typedef struct sleeptest_arg {
+        struct timespec st_req;
+        struct timespec st_rem;
+        int             st_ret;
+} sleeptest_arg_t;
+
+static void *
+sleeptest_sleeper(int arg1, void *arg2)
+{
+        sleeptest_arg_t *st = arg2;
+
+        st->st_ret = do_nanosleep(&st->st_req, &st->st_rem);
+        return NULL;
+}
+
+static void
+sleeptest_yield(void)
+{
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        sched_make_runnable(curthr);
+        sched_switch();
+        intr_setipl(oldipl);
+}
+
+/*
+ * Starts a thread sleeping for 'msecs', cancels it and then, if 'late',
+ * spins until its timer would have gone off before letting it run.
+ */
+static void
+sleeptest_cancel(uint32_t msecs, int late)
+{
+        sleeptest_arg_t st;
+        proc_t *p;
+        kthread_t *thr;
+        uint32_t start;
+        pid_t pid;
+        int status;
+
+        st.st_req.tv_sec = msecs / 1000;
+        st.st_req.tv_nsec = (msecs % 1000) * 1000000;
+        st.st_rem.tv_sec = 0;
+        st.st_rem.tv_nsec = 0;
+        st.st_ret = 1;
+
+        test_assert(NULL != (p = proc_create("sleeptest")), NULL);
+        test_assert(NULL != (thr = kthread_create(p, sleeptest_sleeper, 0, &st)), NULL);
+        pid = p->p_pid;
+
+        start = time_ticks();
+        sched_make_runnable(thr);
+        sleeptest_yield();
+        test_assert(KT_SLEEP_CANCELLABLE == thr->kt_state,
+                    "sleeper is not asleep");
+
+        kthread_cancel(thr, NULL);
+        if (late) {
+                while (time_ticks() - start <= msecs / TICK_MSECS + 1)
+                        ;
+        }
+
+        test_assert(pid == do_waitpid(pid, 0, &status), NULL);
+        test_assert(-EINTR == st.st_ret, "nanosleep returned %d", st.st_ret);
+        if (!late) {
+                test_assert(0 < st.st_rem.tv_sec || 0 < st.st_rem.tv_nsec,
+                            "no time left after cancel");
+        }
+}
+
+int
+sleeptest_main(kshell_t *ksh, int argc, char **argv)
+{
+        test_init();
+
+        dbg(DBG_TEST, "cancelling a sleeping nanosleep\n");
+        sleeptest_cancel(1000, 0);
+
+        dbg(DBG_TEST, "cancelling a nanosleep whose timer then runs out\n");
+        sleeptest_cancel(3 * TICK_MSECS, 1);
+
+        test_fini();
+        return 0;
+}
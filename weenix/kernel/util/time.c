@@ -1,4 +1,7 @@
 #include "globals.h"
+#include "config.h"
+#include "kernel.h"
+#include "errno.h"
 
 #include "main/interrupt.h"
 #include "main/apic.h"
@@ -6,9 +9,223 @@
 
 #include "util/debug.h"
 #include "util/init.h"
+#include "util/string.h"
+#include "util/time.h"
+#include "util/timer.h"
 
 #include "proc/sched.h"
 #include "proc/kthread.h"
 
-#ifdef __UPREEMPT__
-#endif
+#include "mm/page.h"
+#include "mm/pagetable.h"
+
+#include "api/time.h"
+
+/* The clock is the local APIC timer, calibrated against the PIT */
+#define TIME_APIC_DIV           16
+#define TIME_CALIBRATE_MSECS    50
+
+#define TIME_TICK_NSECS         ((uint64_t) TICK_MSECS * 1000000)
+
+static uint32_t time_nticks;         /* clock ticks since boot */
+static uint32_t time_apic_tick;      /* APIC timer counts in a tick */
+static uint32_t time_idle_count;     /* counts the one-shot was set to
+                                      * while idle, or 0 when ticking */
+static uint32_t time_idle_rest;      /* counts of a tick spent idle which
+                                      * did not add up to a whole one */
+static struct clock_page *time_clock; /* the kernel's mapping of the
+                                       * clock page */
+
+uint32_t
+time_ticks(void)
+{
+        return time_nticks;
+}
+
+/*
+ * The count since cp_tsc is split into its high and low 32 bits, so
+ * that each product with cp_mult fits in 64 bits; that of the high
+ * half is shifted left by 32 - cp_shift instead of right by cp_shift.
+ */
+uint64_t
+ktime_ns(void)
+{
+        uint64_t count;
+
+        if (NULL == time_clock) {
+                return 0;
+        }
+
+        count = rdtsc() - time_clock->cp_tsc;
+        return time_clock->cp_ns
+               + (((count >> 32) * time_clock->cp_mult) << (32 - time_clock->cp_shift))
+               + (((count & 0xffffffff) * time_clock->cp_mult) >> time_clock->cp_shift);
+}
+
+/*
+ * The clock interrupt, every TICK_MSECS milliseconds. The running
+ * thread is charged for the tick, and once its slice has run out it is
+ * marked to be switched out. That does not happen here, in the middle
+ * of whatever the thread was doing, but on its way back to userland
+ * (see __intr_handler, with UPREEMPT) or when a kernel thread calls
+ * sched_cond_resched().
+ *
+ * While idle the one-shot going off only wakes the scheduler up;
+ * time_idle_exit() does the counting.
+ */
+static void
+time_tick(regs_t *regs)
+{
+        if (0 != time_idle_count) {
+                return;
+        }
+
+        ++time_nticks;
+        ktimer_run(time_nticks);
+        if (sched_tick()) {
+                curthr->kt_resched = 1;
+        }
+}
+
+/*
+ * Returns how many ticks from now the clock next has to go off while
+ * the processor is idle: when the next timer is due, or as long as the
+ * clock can be stopped for.
+ */
+static uint32_t
+time_next_event(void)
+{
+        return ktimer_next(MIN((uint32_t) TICK_IDLE_MAX, 0xffffffff / time_apic_tick));
+}
+
+void
+time_idle_enter(void)
+{
+        KASSERT(0 == time_idle_count);
+
+        time_idle_count = time_next_event() * time_apic_tick;
+        apic_starttimer(time_idle_count, TIME_APIC_DIV, INTR_APICTIMER, 0);
+}
+
+void
+time_idle_exit(void)
+{
+        uint32_t idle;
+
+        KASSERT(0 != time_idle_count);
+
+        /* The current count stops at 0 if the one-shot went off */
+        idle = time_idle_count - apic_gettimer() + time_idle_rest;
+        time_nticks += idle / time_apic_tick;
+        time_idle_rest = idle % time_apic_tick;
+        time_idle_count = 0;
+        ktimer_run(time_nticks);
+
+        apic_starttimer(time_apic_tick, TIME_APIC_DIV, INTR_APICTIMER, 1);
+}
+
+/*
+ * Nobody wakes the queue slept on, so the sleep ends when its timer
+ * runs out or the thread is cancelled. Sleeps too long for the timer
+ * wheels are taken in parts.
+ */
+int
+do_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+        ktqueue_t q;
+        uint64_t ticks, ns;
+        uint32_t n, start, slept;
+        int err = 0;
+
+        if (0 > req->tv_sec || 0 > req->tv_nsec || NSEC_PER_SEC <= req->tv_nsec) {
+                return -EINVAL;
+        }
+
+        ticks = ((uint64_t) req->tv_sec * NSEC_PER_SEC + req->tv_nsec
+                 + TIME_TICK_NSECS - 1) / TIME_TICK_NSECS;
+        sched_queue_init(&q);
+
+        while (0 < ticks) {
+                n = MIN(ticks, (uint64_t) TIMER_MAX_TICKS);
+                start = time_nticks;
+                if (-EINTR == (err = sched_cancellable_sleep_on_timeout(&q, n))) {
+                        slept = time_nticks - start;
+                        ticks -= MIN(slept, n);
+                        break;
+                }
+                ticks -= n;
+                err = 0;
+        }
+
+        if (-EINTR == err && NULL != rem) {
+                ns = ticks * TIME_TICK_NSECS;
+                rem->tv_sec = ns / NSEC_PER_SEC;
+                rem->tv_nsec = ns % NSEC_PER_SEC;
+        }
+        return err;
+}
+
+/*
+ * Sets up the clock page from the time stamp counter at boot and how
+ * many times it counts a second. cp_mult is made as precise as it can
+ * be while still fitting in 32 bits.
+ */
+static void
+time_clock_init(uint64_t tsc, uint64_t hz)
+{
+        uint64_t mult;
+        uint32_t shift;
+
+        time_clock = page_alloc();
+        KASSERT(NULL != time_clock);
+        memset(time_clock, 0, PAGE_SIZE);
+
+        for (shift = 32; 0 < shift; --shift) {
+                mult = ((uint64_t) NSEC_PER_SEC << shift) / hz;
+                if (0xffffffff >= mult) {
+                        break;
+                }
+        }
+        KASSERT(0 < shift && 0 < mult);
+
+        time_clock->cp_tsc = tsc;
+        time_clock->cp_ns = 0;
+        time_clock->cp_shift = shift;
+        time_clock->cp_mult = mult;
+
+        if (CLOCK_PAGE_ADDR != pt_phys_user_map(pt_virt_to_phys((uintptr_t) time_clock))) {
+                panic("clock page is not mapped at CLOCK_PAGE_ADDR\n");
+        }
+}
+
+/*
+ * Works out how fast the APIC timer and the time stamp counter count
+ * by letting them run for a fixed time measured with the PIT, then
+ * starts the APIC timer ticking every TICK_MSECS.
+ */
+static __attribute__((unused)) void
+time_init(void)
+{
+        uint32_t counted;
+        uint64_t tsc;
+
+        intr_register(INTR_APICTIMER, time_tick);
+
+        apic_starttimer(0xffffffff, TIME_APIC_DIV, INTR_APICTIMER, 0);
+        tsc = rdtsc();
+        pit_delay(TIME_CALIBRATE_MSECS);
+        counted = 0xffffffff - apic_gettimer();
+        time_clock_init(tsc, (rdtsc() - tsc) * 1000 / TIME_CALIBRATE_MSECS);
+
+        time_apic_tick = counted / TIME_CALIBRATE_MSECS * TICK_MSECS;
+        KASSERT(0 < time_apic_tick);
+        dbg(DBG_CORE, "APIC timer: %u counts per %ums tick\n",
+            time_apic_tick, TICK_MSECS);
+        dbg(DBG_CORE, "TSC: %u ns per 2^%u counts\n",
+            time_clock->cp_mult, time_clock->cp_shift);
+
+        apic_starttimer(time_apic_tick, TIME_APIC_DIV, INTR_APICTIMER, 1);
+}
+init_func(time_init);
+init_depends(sched_init);
+init_depends(timer_init);
@@ -0,0 +1,196 @@
+#include "kernel.h"
+
+#include "main/interrupt.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/timer.h"
+
+/* The slot of a wheel a tick falls in */
+#define TIMER_SLOT(tick, level) \
+        (((tick) >> (TIMER_SLOT_BITS * (level))) & (TIMER_SLOTS - 1))
+
+static list_t timer_wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint32_t timer_now;      /* the tick the wheels have been run up to */
+static uint32_t timer_count;    /* timers armed */
+
+static __attribute__((unused)) void
+timer_init(void)
+{
+        int level, slot;
+
+        for (level = 0; level < TIMER_LEVELS; ++level) {
+                for (slot = 0; slot < TIMER_SLOTS; ++slot) {
+                        list_init(&timer_wheel[level][slot]);
+                }
+        }
+}
+init_func(timer_init);
+
+/*
+ * Puts a timer in the slot it belongs in, given how far off it is: on
+ * the lowest wheel whose turn reaches that far. A timer due at or
+ * before the tick being run goes in the slot being run.
+ */
+static void
+timer_insert(ktimer_t *timer)
+{
+        uint32_t when = timer->tm_expires;
+        uint32_t delta = when - timer_now;
+        int level = 0;
+
+        if (0 > (int32_t) delta) {
+                when = timer_now;
+                delta = 0;
+        } else if (TIMER_MAX_TICKS < delta) {
+                when = timer_now + TIMER_MAX_TICKS;
+                delta = TIMER_MAX_TICKS;
+        }
+
+        while (delta >> (TIMER_SLOT_BITS * (level + 1))) {
+                ++level;
+        }
+        list_insert_tail(&timer_wheel[level][TIMER_SLOT(when, level)],
+                         &timer->tm_link);
+}
+
+/*
+ * Called as the first wheel comes round to slot 0: spreads the timers
+ * in the next slot of the second wheel out over the first, and so on
+ * up for each wheel that has come round too.
+ */
+static void
+timer_cascade(void)
+{
+        list_t moved;
+        list_link_t *link;
+        ktimer_t *timer;
+        int level;
+        uint32_t slot;
+
+        for (level = 1; level < TIMER_LEVELS; ++level) {
+                slot = TIMER_SLOT(timer_now, level);
+
+                /* moved off first, since timers which are still too far
+                 * off for the wheels go back in the slot they came from */
+                list_init(&moved);
+                while (!list_empty(&timer_wheel[level][slot])) {
+                        link = timer_wheel[level][slot].l_next;
+                        list_remove(link);
+                        list_insert_tail(&moved, link);
+                }
+                while (!list_empty(&moved)) {
+                        timer = list_head(&moved, ktimer_t, tm_link);
+                        list_remove(&timer->tm_link);
+                        timer_insert(timer);
+                }
+
+                if (0 != slot) {
+                        break;
+                }
+        }
+}
+
+void
+ktimer_init(ktimer_t *timer, void (*func)(void *arg), void *arg)
+{
+        timer->tm_expires = 0;
+        timer->tm_func = func;
+        timer->tm_arg = arg;
+        list_link_init(&timer->tm_link);
+}
+
+void
+ktimer_arm(ktimer_t *timer, uint32_t ticks)
+{
+        uint8_t oldipl;
+
+        KASSERT(0 < ticks);
+
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+
+        if (list_link_is_linked(&timer->tm_link)) {
+                list_remove(&timer->tm_link);
+                --timer_count;
+        }
+        timer->tm_expires = timer_now + ticks;
+        timer_insert(timer);
+        ++timer_count;
+
+        intr_setipl(oldipl);
+}
+
+int
+ktimer_cancel(ktimer_t *timer)
+{
+        uint8_t oldipl;
+        int armed;
+
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+
+        if (0 != (armed = list_link_is_linked(&timer->tm_link))) {
+                list_remove(&timer->tm_link);
+                --timer_count;
+        }
+
+        intr_setipl(oldipl);
+        return armed;
+}
+
+int
+ktimer_armed(ktimer_t *timer)
+{
+        return list_link_is_linked(&timer->tm_link);
+}
+
+void
+ktimer_run(uint32_t now)
+{
+        list_t *slot;
+        ktimer_t *timer;
+
+        while (timer_now != now) {
+                ++timer_now;
+                if (0 == TIMER_SLOT(timer_now, 0)) {
+                        timer_cascade();
+                }
+
+                /* taken off before it is called, so it can arm itself
+                 * again */
+                slot = &timer_wheel[0][TIMER_SLOT(timer_now, 0)];
+                while (!list_empty(slot)) {
+                        timer = list_head(slot, ktimer_t, tm_link);
+                        KASSERT(0 >= (int32_t)(timer->tm_expires - timer_now));
+                        list_remove(&timer->tm_link);
+                        --timer_count;
+                        timer->tm_func(timer->tm_arg);
+                }
+        }
+}
+
+/*
+ * Only the first wheel says exactly when its timers are due, so this
+ * looks no further than the next time it comes round, when timers may
+ * move down onto it. Timers further off than that cost an interrupt
+ * every TIMER_SLOTS ticks of idle time.
+ */
+uint32_t
+ktimer_next(uint32_t max)
+{
+        uint32_t ticks, slot;
+
+        if (0 == timer_count) {
+                return max;
+        }
+
+        for (ticks = 1; ticks < max; ++ticks) {
+                slot = TIMER_SLOT(timer_now + ticks, 0);
+                if (0 == slot || !list_empty(&timer_wheel[0][slot])) {
+                        break;
+                }
+        }
+        return ticks;
+}
@@ -55,6 +55,15 @@ anon_create()
         return NULL;
 }
 
+/*
+ * Returns true if the given object is an anonymous object.
+ */
+int
+mmobj_is_anon(mmobj_t *o)
+{
+        return &anon_mmobj_ops == o->mmo_ops;
+}
+
 /* Implementation of mmobj entry points: */
 
 /*
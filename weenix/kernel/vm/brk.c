@@ -50,6 +50,10 @@
  * Also, despite the statement on the manpage, you MUST support combined use
  * of brk and mmap in the same process.
  *
+ * When the break shrinks, unmap the pages given up from the page table
+ * and TLB the same way do_munmap() does, so that page tables which no
+ * longer map anything are freed.
+ *
  * Note that this function "returns" the new break through the "ret" argument.
  * Return 0 on success, -errno on failure.
  */
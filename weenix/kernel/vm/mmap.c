@@ -6,6 +6,9 @@
 #include "mm/tlb.h"
 #include "mm/mman.h"
 #include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pagetable.h"
 
 #include "proc/proc.h"
 
@@ -18,11 +21,16 @@
 
 #include "vm/vmmap.h"
 #include "vm/mmap.h"
+#include "vm/anon.h"
 
 /*
  * This function implements the mmap(2) syscall, but only
  * supports the MAP_SHARED, MAP_PRIVATE, MAP_FIXED, and
- * MAP_ANON flags.
+ * MAP_ANON flags. MAP_POPULATE and MAP_LOCKED must be accepted
+ * too, but leave them alone: the caller hands the new mapping to
+ * do_mmap_populate() afterwards. MAP_HUGE is accepted and passed on
+ * to vmmap_map() for private anonymous mappings, and ignored
+ * otherwise.
  *
  * Add a mapping to the current process's address space.
  * You need to do some error checking; see the ERRORS section
@@ -44,7 +52,9 @@ do_mmap(void *addr, size_t len, int prot, int flags,
  *
  * As with do_mmap() it should perform the required error checking,
  * before calling upon vmmap_remove() to do most of the work.
- * Remember to clear the TLB.
+ * Remember to clear the TLB: unmap the range from the page table with
+ * a tlb_gather_t (see pt_unmap_range_gather()) and tlb_gather_finish()
+ * it before vmmap_remove() gets a chance to free any of the pages.
  */
 int
 do_munmap(void *addr, size_t len)
@@ -53,3 +63,357 @@ do_munmap(void *addr, size_t len)
         return -1;
 }
 
+
+/*
+ * Checks that [addr, addr + len) is a valid page aligned range of user
+ * memory and that every page in it is mapped, and converts it to the
+ * range of virtual frame numbers [*lopage, *hipage).
+ *
+ * Returns 0 on success, -EINVAL if the range is invalid, and -ENOMEM
+ * if part of it is unmapped.
+ */
+static int
+mmap_range_mapped(void *addr, size_t len, uint32_t *lopage, uint32_t *hipage)
+{
+        uint32_t vfn;
+        vmarea_t *vma;
+
+        if (!PAGE_ALIGNED(addr)) {
+                return -EINVAL;
+        }
+        if ((uintptr_t) addr < USER_MEM_LOW
+            || USER_MEM_HIGH - (uintptr_t) addr < len) {
+                return -EINVAL;
+        }
+
+        *lopage = ADDR_TO_PN(addr);
+        *hipage = ADDR_TO_PN(PAGE_ALIGN_UP((uintptr_t) addr + len));
+
+        for (vfn = *lopage; vfn < *hipage; vfn = vma->vma_end) {
+                if (NULL == (vma = vmmap_lookup(curproc->p_vmmap, vfn))) {
+                        return -ENOMEM;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Faults in and maps every page of every area overlapping the given
+ * range, pinning the pages and marking the areas MAP_LOCKED if lock is
+ * set. Areas which are already locked are left alone, and so are
+ * PROT_NONE areas, whose pages must not be mapped for the user.
+ */
+static int
+mmap_populate_areas(uint32_t lopage, uint32_t hipage, int lock)
+{
+        uint32_t vfn;
+        vmarea_t *vma;
+        int err;
+
+        for (vfn = lopage; vfn < hipage; vfn = vma->vma_end) {
+                vma = vmmap_lookup(curproc->p_vmmap, vfn);
+                KASSERT(NULL != vma);
+                if ((vma->vma_flags & MAP_LOCKED)
+                    || PROT_NONE == (vma->vma_prot & (PROT_READ | PROT_WRITE | PROT_EXEC))) {
+                        continue;
+                }
+                if (0 > (err = vmarea_populate(vma, vma->vma_start, vma->vma_end, lock))) {
+                        return err;
+                }
+                if (lock) {
+                        vma->vma_flags |= MAP_LOCKED;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Handles the MAP_POPULATE and MAP_LOCKED flags of a mapping which has
+ * just been created by do_mmap(), faulting in (and for MAP_LOCKED,
+ * pinning) all of its pages so that the process does not take a page
+ * fault on them later.
+ */
+int
+do_mmap_populate(void *addr, size_t len, int flags)
+{
+        uint32_t lopage, hipage;
+        int err;
+
+        if (!(flags & (MAP_POPULATE | MAP_LOCKED))) {
+                return 0;
+        }
+        if (0 > (err = mmap_range_mapped(addr, len, &lopage, &hipage))) {
+                return err;
+        }
+        return mmap_populate_areas(lopage, hipage, flags & MAP_LOCKED);
+}
+
+/*
+ * This function implements the mlock(2) syscall.
+ *
+ * Every page of the areas touched by the range is faulted in, mapped
+ * and pinned so that it is never paged out. As with madvise(2) areas
+ * are not split, so a lock always covers whole areas.
+ *
+ * Every page in the range must be mapped, otherwise -ENOMEM is
+ * returned without doing anything.
+ */
+int
+do_mlock(void *addr, size_t len)
+{
+        uint32_t lopage, hipage;
+        int err;
+
+        if (0 > (err = mmap_range_mapped(addr, len, &lopage, &hipage))) {
+                return err;
+        }
+        return mmap_populate_areas(lopage, hipage, 1);
+}
+
+/*
+ * This function implements the munlock(2) syscall, unpinning the pages
+ * of all locked areas touched by the range. The pages stay mapped.
+ */
+int
+do_munlock(void *addr, size_t len)
+{
+        uint32_t lopage, hipage, vfn;
+        vmarea_t *vma;
+        int err;
+
+        if (0 > (err = mmap_range_mapped(addr, len, &lopage, &hipage))) {
+                return err;
+        }
+
+        for (vfn = lopage; vfn < hipage; vfn = vma->vma_end) {
+                vma = vmmap_lookup(curproc->p_vmmap, vfn);
+                KASSERT(NULL != vma);
+                if (vma->vma_flags & MAP_LOCKED) {
+                        vmarea_unlock(vma, vma->vma_start, vma->vma_end);
+                        vma->vma_flags &= ~MAP_LOCKED;
+                        vma->vma_lockobj->mmo_ops->put(vma->vma_lockobj);
+                        vma->vma_lockobj = NULL;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Reads the pages [lopage, hipage) of the given area into the pframe
+ * cache without mapping them. There is nothing to read in for areas
+ * backed by zero-fill memory, so those are left alone.
+ */
+static int
+madvise_willneed(vmarea_t *vma, uint32_t lopage, uint32_t hipage)
+{
+        uint32_t vfn;
+        pframe_t *pf;
+        int err;
+
+        if (mmobj_is_anon(mmobj_bottom_obj(vma->vma_obj))) {
+                return 0;
+        }
+
+        for (vfn = lopage; vfn < hipage; ++vfn) {
+                uint32_t pagenum = vma->vma_off + vfn - vma->vma_start;
+                if (0 > (err = pframe_lookup(vma->vma_obj, pagenum, 0, &pf))) {
+                        return err;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Frees the resident page pagenum of the object o, once it is no
+ * longer busy, unless someone other than the object has it pinned.
+ * Returns whether the page is gone from the object. The page is given
+ * back through tg once the TLB has been flushed.
+ */
+static int
+madvise_free_page(tlb_gather_t *tg, mmobj_t *o, uint32_t pagenum)
+{
+        pframe_t *pf;
+        int waited;
+
+        /* the pframe may be freed and reused while we sleep, so
+         * only a wait for this same page again is spurious */
+        waited = 0;
+        while (NULL != (pf = pframe_get_resident(o, pagenum))
+               && pframe_is_busy(pf)) {
+                if (waited) {
+                        sched_queue_spurious(&pf->pf_waitq);
+                }
+                waited = 1;
+                sched_sleep_on(&pf->pf_waitq);
+        }
+        if (NULL == pf) {
+                return 1;
+        }
+        /* leave pages which someone other than the object has pinned */
+        if (1 < pf->pf_pincount) {
+                return 0;
+        }
+        if (pframe_is_pinned(pf)) {
+                pframe_unpin(pf);
+        }
+        pframe_free_gather(tg, pf);
+        return 1;
+}
+
+/*
+ * Frees page pagenum from every object under the top one of a private
+ * anonymous area, so that it refaults as zeros from the anonymous
+ * object at the bottom. This is only done while the objects are
+ * reached through this area alone (see vmmap_reclaimable()); once the
+ * chain meets an object with a second user, e.g. one shared with a
+ * child since fork(), the page must stay if it is still held at or
+ * below it. Returns whether the page is gone from the whole chain.
+ */
+static int
+madvise_free_shadowed(tlb_gather_t *tg, mmobj_t *top, uint32_t pagenum)
+{
+        mmobj_t *o;
+
+        for (o = top->mmo_shadowed; NULL != o && 1 == o->mmo_refcount - o->mmo_nrespages;
+             o = o->mmo_shadowed) {
+                if (!madvise_free_page(tg, o, pagenum)) {
+                        return 0;
+                }
+        }
+        for (; NULL != o; o = o->mmo_shadowed) {
+                if (NULL != pframe_find_resident(o, pagenum)) {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/*
+ * Drops the private copies of the pages [lopage, hipage) of a
+ * MAP_PRIVATE area, i.e. the pages held by the area's top shadow
+ * object, so that the next access refaults them from the object
+ * underneath. Private anonymous memory must read back as zeros, so an
+ * older copy of a page further down the shadow chain is freed as well
+ * when nothing else uses it. If it is shared, as after fork(), the top
+ * copy is zeroed in place instead, allocating it if there was none:
+ * such pages are not given back, and dropping them does not lower the
+ * resident set. The pages freed are given back through tg once the TLB
+ * has been flushed.
+ */
+static int
+madvise_dontneed_private(tlb_gather_t *tg, vmarea_t *vma, uint32_t lopage, uint32_t hipage)
+{
+        mmobj_t *top = vma->vma_obj;
+        int anon = mmobj_is_anon(mmobj_bottom_obj(top));
+        uint32_t vfn;
+        pframe_t *pf;
+        int err;
+
+        KASSERT(NULL != top->mmo_shadowed);
+
+        for (vfn = lopage; vfn < hipage; ++vfn) {
+                uint32_t pagenum = vma->vma_off + vfn - vma->vma_start;
+
+                if (anon && !madvise_free_shadowed(tg, top, pagenum)) {
+                        if (0 > (err = pframe_lookup(top, pagenum, 1, &pf))) {
+                                return err;
+                        }
+                        if (0 > (err = pframe_dirty(pf))) {
+                                return err;
+                        }
+                        memset(pf->pf_addr, 0, PAGE_SIZE);
+                        continue;
+                }
+
+                madvise_free_page(tg, top, pagenum);
+        }
+        return 0;
+}
+
+/*
+ * This function implements the madvise(2) syscall, supporting the
+ * MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL, MADV_WILLNEED and
+ * MADV_DONTNEED advice values.
+ *
+ * The access pattern hints are recorded in vma_advice and take effect
+ * when the pages of the area are faulted in, through
+ * pagefault_apply_advice() which _pt_fault_handler() calls once
+ * handle_pagefault() has mapped the faulting page.
+ * Since we never split areas to apply a hint, they apply to every
+ * area the range touches as a whole. MADV_WILLNEED reads the range
+ * into the pframe cache, and MADV_DONTNEED unmaps the range and
+ * throws away private copies of its pages. Private anonymous pages
+ * still shared with another process since fork() are zeroed rather
+ * than freed, so MADV_DONTNEED does not shrink the resident set there.
+ *
+ * Every page in the range must be mapped, otherwise -ENOMEM is
+ * returned without doing anything. Locked pages cannot be dropped, so
+ * MADV_DONTNEED on a range touching a MAP_LOCKED area fails with
+ * -EINVAL.
+ */
+int
+do_madvise(void *addr, size_t len, int advice)
+{
+        vmmap_t *map = curproc->p_vmmap;
+        uint32_t lopage, hipage, vfn, end;
+        vmarea_t *vma;
+        tlb_gather_t tg;
+        int err;
+
+        switch (advice) {
+                case MADV_NORMAL:
+                case MADV_RANDOM:
+                case MADV_SEQUENTIAL:
+                case MADV_WILLNEED:
+                case MADV_DONTNEED:
+                        break;
+                default:
+                        return -EINVAL;
+        }
+        if (0 == len) {
+                return PAGE_ALIGNED(addr) ? 0 : -EINVAL;
+        }
+        if (0 > (err = mmap_range_mapped(addr, len, &lopage, &hipage))) {
+                return err;
+        }
+
+        if (MADV_DONTNEED == advice) {
+                for (vfn = lopage; vfn < hipage; vfn = vma->vma_end) {
+                        vma = vmmap_lookup(map, vfn);
+                        if (vma->vma_flags & MAP_LOCKED) {
+                                return -EINVAL;
+                        }
+                }
+                tlb_gather_init(&tg, curproc->p_pagedir);
+                pt_unmap_range_gather(&tg, (uintptr_t) PN_TO_ADDR(lopage),
+                                      (uintptr_t) PN_TO_ADDR(hipage));
+        }
+
+        for (vfn = lopage; vfn < hipage; vfn = end) {
+                vma = vmmap_lookup(map, vfn);
+                KASSERT(NULL != vma);
+                end = MIN(hipage, vma->vma_end);
+
+                switch (advice) {
+                        case MADV_WILLNEED:
+                                if (0 > (err = madvise_willneed(vma, vfn, end))) {
+                                        return err;
+                                }
+                                break;
+                        case MADV_DONTNEED:
+                                if (MAP_PRIVATE == (vma->vma_flags & MAP_TYPE)
+                                    && 0 > (err = madvise_dontneed_private(&tg, vma, vfn, end))) {
+                                        tlb_gather_finish(&tg);
+                                        return err;
+                                }
+                                break;
+                        default:
+                                vma->vma_advice = advice;
+                                break;
+                }
+        }
+        if (MADV_DONTNEED == advice) {
+                tlb_gather_finish(&tg);
+        }
+        return 0;
+}
@@ -2,8 +2,10 @@
 #include "globals.h"
 #include "kernel.h"
 #include "errno.h"
+#include "config.h"
 
 #include "util/debug.h"
+#include "util/string.h"
 
 #include "proc/proc.h"
 
@@ -13,9 +15,158 @@
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
 #include "mm/pagetable.h"
+#include "mm/tlb.h"
 
 #include "vm/pagefault.h"
 #include "vm/vmmap.h"
+#include "vm/anon.h"
+
+/*
+ * Applies the madvise(2) hint of the area around vaddr once a fault on
+ * vaddr has been handled; _pt_fault_handler calls this after
+ * handle_pagefault returns. For MADV_SEQUENTIAL areas backed by a file
+ * the next VM_READAHEAD_PAGES pages of the area are read into the
+ * pframe cache, and the page behind the one just faulted in is handed
+ * to pageoutd first. MADV_NORMAL and MADV_RANDOM areas do no
+ * read-ahead.
+ */
+void
+pagefault_apply_advice(uintptr_t vaddr)
+{
+        uint32_t vfn = ADDR_TO_PN(vaddr);
+        vmarea_t *vma = vmmap_lookup(curproc->p_vmmap, vfn);
+        mmobj_t *bottom;
+        uint32_t pagenum, end;
+        pframe_t *pf;
+
+        if (NULL == vma) {
+                return;
+        }
+        bottom = mmobj_bottom_obj(vma->vma_obj);
+        pagenum = vma->vma_off + vfn - vma->vma_start;
+
+        if (MADV_SEQUENTIAL != vma->vma_advice || mmobj_is_anon(bottom)) {
+                return;
+        }
+
+        if (vfn > vma->vma_start
+            && NULL != (pf = pframe_find_resident(bottom, pagenum - 1))
+            && !pframe_is_busy(pf)) {
+                pframe_deactivate(pf);
+        }
+
+        end = MIN(vma->vma_end, vfn + 1 + VM_READAHEAD_PAGES);
+        for (++vfn, ++pagenum; vfn < end; ++vfn, ++pagenum) {
+                if (NULL == pframe_get_resident(bottom, pagenum)
+                    && 0 > pframe_lookup(vma->vma_obj, pagenum, 0, &pf)) {
+                        break;
+                }
+        }
+}
+
+/*
+ * Tries to map the PT_LARGE_PAGES-aligned chunk of a MAP_HUGE area
+ * around vfn with a single 4mb page. This is only done for private
+ * anonymous areas where the whole chunk lies inside the area and none
+ * of its pages is resident anywhere in the shadow chain yet. The 4mb
+ * block is zeroed and its pages are handed to the area's top object as
+ * ordinary pframes, pinned like every other page of a shadow object, so
+ * that everything else (vmmap_read, copy-on-write, unmapping) keeps
+ * working on 4k pages; the page table code splits the 4mb mapping
+ * whenever part of it changes.
+ *
+ * Returns 1 if the chunk was mapped, 0 if the caller should fault in
+ * the single page as usual, in which case nothing is left charged,
+ * adopted or allocated.
+ */
+int
+vmarea_fault_huge(vmarea_t *vma, uint32_t vfn)
+{
+        uint32_t lovfn = vfn & ~(PT_LARGE_PAGES - 1);
+        uint32_t pagenum = vma->vma_off + lovfn - vma->vma_start;
+        mmobj_t *top = vma->vma_obj;
+        mmobj_t *o;
+        pframe_t *pf;
+        tlb_gather_t tg;
+        uintptr_t phys;
+        uint32_t i, j, pdflags;
+        char *block;
+
+        if (!(vma->vma_flags & MAP_HUGE) || MAP_PRIVATE != (vma->vma_flags & MAP_TYPE)
+            || !pt_large_pages() || NULL == top->mmo_shadowed
+            || !mmobj_is_anon(mmobj_bottom_obj(top))
+            || lovfn < vma->vma_start || lovfn + PT_LARGE_PAGES > vma->vma_end) {
+                return 0;
+        }
+
+        for (o = top; NULL != o; o = o->mmo_shadowed) {
+                if (0 == o->mmo_nrespages) {
+                        continue;
+                }
+                for (i = 0; i < PT_LARGE_PAGES; ++i) {
+                        if (NULL != pframe_get_resident(o, pagenum + i)) {
+                                return 0;
+                        }
+                }
+        }
+
+        /* charged first, as going over the limit reclaims pages */
+        if (0 > proc_charge_rss(curproc, PT_LARGE_PAGES)) {
+                return 0;
+        }
+        if (NULL == (block = page_alloc_n(PT_LARGE_PAGES))) {
+                goto uncharge;
+        }
+        phys = pt_virt_to_phys((uintptr_t)block);
+        if (0 != phys % (PT_LARGE_PAGES * PAGE_SIZE)) {
+                page_free_n(block, PT_LARGE_PAGES);
+                goto uncharge;
+        }
+        memset(block, 0, PT_LARGE_PAGES * PAGE_SIZE);
+
+        for (i = 0; i < PT_LARGE_PAGES; ++i) {
+                if (NULL == (pf = pframe_adopt(top, pagenum + i, block + i * PAGE_SIZE))) {
+                        goto unadopt;
+                }
+                pframe_pin(pf);
+                /* The mapping is writable without faults, so the pages
+                 * are dirtied up front */
+                if ((vma->vma_prot & PROT_WRITE) && 0 > pframe_dirty(pf)) {
+                        ++i;
+                        goto unadopt;
+                }
+        }
+
+        pdflags = PD_PRESENT | PD_USER;
+        if (vma->vma_prot & PROT_WRITE) {
+                pdflags |= PD_WRITE;
+        }
+        if (0 > pt_map_large(curproc->p_pagedir, (uintptr_t)PN_TO_ADDR(lovfn), phys, pdflags)) {
+                goto unadopt;
+        }
+
+        dbg(DBG_VM, "mapped 4mb page at 0x%p for pid %d\n", PN_TO_ADDR(lovfn), curproc->p_pid);
+        return 1;
+
+unadopt:
+        /* Nothing maps the first i pages yet, so they are taken back
+         * out of the object, and the rest of the block is freed along
+         * with them */
+        tlb_gather_init(&tg, pt_get());
+        for (j = 0; j < i; ++j) {
+                pf = pframe_find_resident(top, pagenum + j);
+                KASSERT(NULL != pf && 1 == pf->pf_pincount);
+                pframe_unpin(pf);
+                pframe_free_gather(&tg, pf);
+        }
+        tlb_gather_finish(&tg);
+        for (; i < PT_LARGE_PAGES; ++i) {
+                page_free(block + i * PAGE_SIZE);
+        }
+uncharge:
+        curproc->p_rss_charged -= MIN(curproc->p_rss_charged, PT_LARGE_PAGES);
+        return 0;
+}
 
 /*
  * This gets called by _pt_fault_handler in mm/pagetable.c The
@@ -40,7 +191,22 @@
  * correctly.
  *
  * Finally call pt_map to have the new mapping placed into the
- * appropriate page table.
+ * appropriate page table. Any madvise(2) hint on the area is applied
+ * by the caller once this returns.
+ *
+ * For a MAP_HUGE area, call vmarea_fault_huge() once the permissions
+ * have been checked; if it returns 1 the fault has been handled.
+ *
+ * Before looking up a page which vmarea_page_resident() says is not
+ * resident for this access yet, i.e. one the lookup will allocate a
+ * new frame for, call proc_charge_rss(curproc, 1); if it fails the
+ * process has hit its RLIMIT_RSS limit and nothing of its own could be
+ * reclaimed, so it is out of memory: kill it with exit status ENOMEM.
+ *
+ * Count every fault which is handled in curproc->p_rusage: remember
+ * ru_pageins before looking the page up, and count a major fault if
+ * the lookup read a page in (ru_pageins went up), a minor one
+ * otherwise.
  *
  * @param vaddr the address that was accessed to cause the fault
  *
@@ -1,5 +1,6 @@
 #include "globals.h"
 #include "errno.h"
+#include "config.h"
 
 #include "util/string.h"
 #include "util/debug.h"
@@ -60,6 +61,10 @@ shadow_init()
  * return, then then initialize it. Take a look in mm/mmobj.h for
  * macros which can be of use here. Make sure your initial
  * reference count is correct.
+ *
+ * Whoever sets mmo_shadowed must also set mmo_un.mmo_bottom_obj; the
+ * collapse code below relies on it never changing for the life of
+ * the object.
  */
 mmobj_t *
 shadow_create()
@@ -99,7 +104,13 @@ shadow_put(mmobj_t *o)
  * must handle all do-not-copy-on-not-write magic (i.e. when forwrite
  * is false find the first shadow object in the chain which has the
  * given page resident). copy-on-write magic (necessary when forwrite
- * is true) is handled in shadow_fillpage, not here. */
+ * is true) is handled in shadow_fillpage, not here.
+ *
+ * Only look for resident pages in the shadow objects themselves; if
+ * none of them has the page, go straight to mmo_un.mmo_bottom_obj
+ * rather than stepping onto the bottom object. Chains are kept at most
+ * SHADOW_MAX_DEPTH objects deep (see shadow_limit_depth()), so the
+ * walk is short. */
 static int
 shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 {
@@ -137,3 +148,153 @@ shadow_cleanpage(mmobj_t *o, pframe_t *pf)
         NOT_YET_IMPLEMENTED("VM: shadow_cleanpage");
         return -1;
 }
+
+/*
+ * The functions below are not mmobj entry points. The VM code calls them
+ * to keep shadow chains short, so that faulting on a page costs the same
+ * however many generations of fork a process has been through.
+ */
+
+/* Whether any page of the shadow object is pinned by mlock(2) on top of
+ * the pin every shadow object page carries. */
+static int
+shadow_has_locked_pages(mmobj_t *o)
+{
+        pframe_t *pf;
+
+        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                if (1 < pf->pf_pincount) {
+                        return 1;
+                }
+        } list_iterate_end();
+        return 0;
+}
+
+/*
+ * Removes from the chain below 'top' every shadow object which nothing
+ * but the object above it refers to, migrating its pages up into that
+ * object first (the same cleanup shadowd performs). This does not
+ * block: by the time such an object is put it has no pages left.
+ * Objects holding locked pages are left alone, since migrating could
+ * free a locked page which vmarea_unlock() expects to find.
+ *
+ * Returns the number of shadow objects left in the chain, counting top.
+ */
+int
+shadow_collapse(mmobj_t *top)
+{
+        mmobj_t *last = top, *o = top->mmo_shadowed;
+        int depth = 1;
+
+        KASSERT(NULL != o);
+        while (NULL != o->mmo_shadowed) {
+                mmobj_t *shadowed = o->mmo_shadowed;
+                if (o->mmo_refcount - o->mmo_nrespages == 1
+                    && !shadow_has_locked_pages(o)) {
+                        pframe_t *pf;
+                        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                                /* Intermediate shadow objects only ever
+                                 * have their pages read */
+                                KASSERT(!pframe_is_busy(pf));
+                                pframe_migrate(pf, last);
+                        } list_iterate_end();
+                        /* last takes over o's reference on shadowed */
+                        shadowed->mmo_ops->ref(shadowed);
+                        last->mmo_shadowed = shadowed;
+                        KASSERT(o->mmo_refcount == 1 && o->mmo_nrespages == 0);
+                        o->mmo_ops->put(o);
+                } else {
+                        last = o;
+                        depth++;
+                }
+                o = shadowed;
+        }
+        return depth;
+}
+
+/*
+ * Copies into 'top' every page which one of the shadow objects below it
+ * holds and it does not, then hangs 'top' directly off the bottom
+ * object. The objects skipped are only put, as other chains may still
+ * go through them. On failure the chain is left as it was.
+ */
+static int
+shadow_flatten(mmobj_t *top)
+{
+        mmobj_t *o, *next, *bottom = mmobj_bottom_obj(top);
+        pframe_t *pf, *copy;
+        int ret;
+
+        for (o = top->mmo_shadowed; o != bottom; o = next) {
+                o->mmo_ops->ref(o);
+again:
+                list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                        if (NULL == pframe_get_resident(top, pf->pf_pagenum)) {
+                                /* Filling the copy may block, and o's page
+                                 * list with it, so rescan o afterwards */
+                                if (0 > (ret = pframe_get(top, pf->pf_pagenum, &copy))) {
+                                        o->mmo_ops->put(o);
+                                        return ret;
+                                }
+                                goto again;
+                        }
+                } list_iterate_end();
+                next = o->mmo_shadowed;
+                o->mmo_ops->put(o);
+        }
+
+        o = top->mmo_shadowed;
+        bottom->mmo_ops->ref(bottom);
+        top->mmo_shadowed = bottom;
+        o->mmo_ops->put(o);
+        return 0;
+}
+
+/*
+ * Collapses the chain below 'top' and, if it is still more than
+ * SHADOW_MAX_DEPTH shadow objects deep because the objects in it are
+ * shared with other processes, flattens it. Called on each private
+ * area of a process about to fork, since the fork adds another level.
+ *
+ * A chain with locked pages below 'top' is left deep: copying them up
+ * would hide them from vmarea_unlock(), which looks them up from the
+ * object they were locked in, and that may be 'top' itself.
+ *
+ * Returns 0 on success, -errno if the chain could not be flattened (it
+ * is then merely deeper than it should be).
+ */
+int
+shadow_limit_depth(mmobj_t *top)
+{
+        mmobj_t *o;
+
+        if (SHADOW_MAX_DEPTH < shadow_collapse(top)) {
+                for (o = top->mmo_shadowed; NULL != o->mmo_shadowed; o = o->mmo_shadowed) {
+                        if (shadow_has_locked_pages(o)) {
+                                return 0;
+                        }
+                }
+                return shadow_flatten(top);
+        }
+        return 0;
+}
+
+/*
+ * Collapses the chain of every area which has 'bottom' at the bottom of
+ * it. When an area goes away (the process exits or unmaps it), shadow
+ * objects it shared with other processes' areas may be left referenced
+ * by only one of them; this removes them right away instead of waiting
+ * for shadowd. The caller must hold a reference on 'bottom'.
+ */
+void
+shadow_collapse_siblings(mmobj_t *bottom)
+{
+        vmarea_t *vma;
+
+        KASSERT(NULL == bottom->mmo_shadowed);
+        list_iterate_begin(&bottom->mmo_un.mmo_vmas, vma, vmarea_t, vma_olink) {
+                if (NULL != vma->vma_obj->mmo_shadowed) {
+                        shadow_collapse(vma->vma_obj);
+                }
+        } list_iterate_end();
+}
@@ -4,6 +4,9 @@
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
 
+#include "vm/vmmap.h"
+#include "vm/shadow.h"
+
 #include "util/debug.h"
 #include "util/string.h"
 
@@ -22,17 +25,26 @@ shadowd_wakeup()
          * before it has been properly initialized then the system
          * does not have enough memory. */
         KASSERT(shadowd_initialized);
-        sched_broadcast_on(&shadowd_waitq);
+        sched_wakeup_on(&shadowd_waitq);
 }
 
 void
-shadowd_alloc_sleep()
+shadowd_alloc_sleep(int again)
 {
         /* If we run out of memory and need to wake up shadowd
          * before it has been properly initialized then the system
          * does not have enough memory. */
         KASSERT(shadowd_initialized);
-        sched_sleep_on(&kmem_alloc_waitq);
+        if (again) {
+                sched_queue_spurious(&kmem_alloc_waitq);
+        }
+        sched_sleep_on_exclusive(&kmem_alloc_waitq);
+}
+
+void
+shadowd_alloc_done()
+{
+        sched_wakeup_on(&kmem_alloc_waitq);
 }
 
 /*
@@ -47,8 +59,12 @@ shadowd_alloc_sleep()
  * For each shadow object we want to migrate all of its pages up
  * to the closest mmobj with at least 2 parents, or the topmost
  * one, then remove this object from the tree (if we remove it any
- * earlier we can cause big problems).
+ * earlier we can cause big problems). shadow_collapse() does this
+ * for one chain.
  *
+ * Fork, exit and munmap already collapse the chains they affect (see
+ * shadow_limit_depth() and shadow_collapse_siblings()), so this only
+ * catches what they miss.
  */
 
 static void *
@@ -62,47 +78,15 @@ shadowd(int arg1, void *arg2)
                         if (PROC_RUNNING == p->p_state) {
                                 vmarea_t *vma;
                                 list_iterate_begin(&p->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
-                                        mmobj_t *last = vma->vma_obj, *o = last->mmo_shadowed;
-                                        /* ref last, so if all processes on this branch die while shadowd is
-                                         * sleeping, the branch won't get destroyed until shadowd() is done
-                                         * with it */
-                                        last->mmo_ops->ref(last);
-                                        while (NULL != o && NULL != o->mmo_shadowed) {
-                                                mmobj_t *shadow = o->mmo_shadowed;
-                                                /* iff the object has only one parent, and is not right under vm_area */
-                                                KASSERT(o != last);
-                                                if (o->mmo_refcount - o->mmo_nrespages == 1) {
-                                                        /* migrate all its pages to last, and remove it from the shadow tree */
-                                                        pframe_t *pf;
-                                                        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
-                                                                /* Because the operations that could be
-                                                                 * performed with an intermediate shadow object
-                                                                 * to make pages busy are non-blocking,
-                                                                 * we always expect to see non-busy pages. */
-                                                                KASSERT(!pframe_is_busy(pf));
-                                                                /* o has refcount 1+nrespages, so this won't delete it yet */
-                                                                pframe_migrate(pf, last);
-                                                        } list_iterate_end();
-                                                        last->mmo_shadowed = o->mmo_shadowed;
-                                                        /* Ref o's shadowed, so we don't accidentally delete it when we
-                                                         * finally put o */
-                                                        o->mmo_shadowed->mmo_ops->ref(o->mmo_shadowed);
-                                                        KASSERT(o->mmo_refcount == 1 && o->mmo_nrespages == 0);
-                                                        o->mmo_ops->put(o);
-                                                } else {
-                                                        KASSERT(o->mmo_refcount - o->mmo_nrespages == 2);
-                                                        o->mmo_ops->ref(o);
-                                                        last->mmo_ops->put(last);
-                                                        last = o;
-                                                }
-                                                o = shadow;
+                                        if (NULL != vma->vma_obj->mmo_shadowed) {
+                                                shadow_collapse(vma->vma_obj);
                                         }
-                                        KASSERT(NULL != last);
-                                        last->mmo_ops->put(last);
                                 } list_iterate_end();
                         }
                 } list_iterate_end();
 
+                /* wakes the first thread waiting for memory, which
+                 * passes it on (see shadowd_alloc_done) */
                 sched_broadcast_on(&kmem_alloc_waitq);
                 if (sched_cancellable_sleep_on(&shadowd_waitq) < 0) {
                         return (void *)0;
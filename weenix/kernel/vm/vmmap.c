@@ -23,6 +23,9 @@
 #include "mm/mm.h"
 #include "mm/mman.h"
 #include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
 
 static slab_allocator_t *vmmap_allocator;
 static slab_allocator_t *vmarea_allocator;
@@ -42,6 +45,8 @@ vmarea_alloc(void)
         vmarea_t *newvma = (vmarea_t *) slab_obj_alloc(vmarea_allocator);
         if (newvma) {
                 newvma->vma_vmmap = NULL;
+                newvma->vma_advice = MADV_NORMAL;
+                newvma->vma_lockobj = NULL;
         }
         return newvma;
 }
@@ -63,7 +68,9 @@ vmmap_create(void)
 }
 
 /* Removes all vmareas from the address space and frees the
- * vmmap struct. */
+ * vmmap struct. Remember to vmarea_unlock() any MAP_LOCKED areas and
+ * put their vma_lockobj. Use vmarea_put_obj() to let go of each area's
+ * mmobj. */
 void
 vmmap_destroy(vmmap_t *map)
 {
@@ -105,7 +112,10 @@ vmmap_lookup(vmmap_t *map, uint32_t vfn)
 }
 
 /* Allocates a new vmmap containing a new vmarea for each area in the
- * given map. The areas should have no mmobjs set yet. Returns pointer
+ * given map. The areas should have no mmobjs set yet, but should keep
+ * the madvise(2) hint (vma_advice) of the original area. Memory locks are
+ * not inherited, so clear MAP_LOCKED and vma_lockobj in the new areas.
+ * Returns pointer
  * to the new vmmap on success, NULL on failure. This function is
  * called when implementing fork(2). */
 vmmap_t *
@@ -115,6 +125,34 @@ vmmap_clone(vmmap_t *map)
         return NULL;
 }
 
+/*
+ * Copies the page table entries of every area in the given map from
+ * the page directory 'from' into 'to', so that a forked child starts
+ * out with the parent's resident pages mapped instead of faulting them
+ * all back in. Entries of private areas are write-protected in both
+ * page directories, so the first write to such a page from either
+ * process faults and copies it into that process's shadow object.
+ * The caller must flush the TLB for 'from' if it is in use.
+ *
+ * Returns 0 on success, -ENOMEM if page tables could not be allocated;
+ * in that case the entries which were not copied will simply fault in.
+ */
+int
+vmmap_clone_ptes(vmmap_t *map, pagedir_t *from, pagedir_t *to)
+{
+        vmarea_t *vma;
+        int err;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                if (0 > (err = pt_copy_range(to, from, (uintptr_t) PN_TO_ADDR(vma->vma_start),
+                                             (uintptr_t) PN_TO_ADDR(vma->vma_end),
+                                             MAP_PRIVATE == (vma->vma_flags & MAP_TYPE)))) {
+                        return err;
+                }
+        } list_iterate_end();
+        return 0;
+}
+
 /* Insert a mapping into the map starting at lopage for npages pages.
  * If lopage is zero, we will find a range of virtual addresses in the
  * process that is big enough, by using vmmap_find_range with the same
@@ -129,6 +167,8 @@ vmmap_clone(vmmap_t *map)
  * calling mmap.
  *
  * If MAP_PRIVATE is specified set up a shadow object for the mmobj.
+ * Keep MAP_HUGE in the area's vma_flags if it is given, so that
+ * handle_pagefault() tries vmarea_fault_huge() on it.
  *
  * All of the input to this function should be valid (KASSERT!).
  * See mmap(2) for for description of legal input.
@@ -163,7 +203,8 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
  * Case 1:  [   ******    ]
  * The region to be unmapped lies completely inside the vmarea. We need to
  * split the old vmarea into two vmareas. be sure to increment the
- * reference count to the file associated with the vmarea.
+ * reference count to the file associated with the vmarea, and to copy
+ * the vma_advice of the old vmarea into the new one.
  *
  * Case 2:  [      *******]**
  * The region overlaps the end of the vmarea. Just shorten the length of
@@ -175,7 +216,12 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
  *
  * Case 4: *[*************]**
  * The region completely contains the vmarea. Remove the vmarea from the
- * list.
+ * list, and let go of its mmobj with vmarea_put_obj().
+ *
+ * If the vmarea is MAP_LOCKED, call vmarea_unlock() on the part of it
+ * being unmapped before touching the area, and put its vma_lockobj if
+ * the whole area goes. When an area is split, both parts keep its
+ * vma_lockobj, so take another reference on it.
  */
 int
 vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
@@ -225,6 +271,289 @@ vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count)
         return 0;
 }
 
+/*
+ * Returns whether looking up page pagenum of the area's object, for
+ * writing if forwrite is set, would find a frame already resident
+ * rather than allocate a new one: a write needs the page in the top
+ * object, anything else finds it anywhere down the shadow chain.
+ * The LRU is left alone.
+ */
+int
+vmarea_page_resident(vmarea_t *vma, uint32_t pagenum, int forwrite)
+{
+        mmobj_t *o;
+
+        for (o = vma->vma_obj; NULL != o; o = o->mmo_shadowed) {
+                if (NULL != pframe_find_resident(o, pagenum)) {
+                        return 1;
+                }
+                if (forwrite) {
+                        break;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Returns whether faulting in a page of the area would have to
+ * produce a private, writable copy of it (see handle_pagefault).
+ */
+static int
+vmarea_populate_forwrite(vmarea_t *vma)
+{
+        return (vma->vma_prot & PROT_WRITE)
+               && MAP_PRIVATE == (vma->vma_flags & MAP_TYPE);
+}
+
+/*
+ * Faults in the pages [lopage, hipage) of the given area of the
+ * current process and maps them, exactly as handle_pagefault() would
+ * on a first read, so that touching them later does not fault. Pages
+ * of private writable areas are copied up front and mapped writable.
+ * Pages of shared writable areas are mapped read-only, so the first
+ * write still faults and dirties them, unless they are being locked:
+ * then they are dirtied up front and mapped writable. The area must be
+ * accessible (not PROT_NONE).
+ *
+ * If lock is set every page is also pinned, so the pageout daemon
+ * leaves it alone until vmarea_unlock() is called on it, and the area
+ * takes a reference on the object the pages were looked up in, kept in
+ * vma_lockobj. On error the pages pinned so far are unpinned again and
+ * the reference is put. Fails with -ENOMEM if the pages which have to be
+ * brought in would take the process over its RLIMIT_RSS limit.
+ *
+ * Returns 0 on success, -errno on error.
+ */
+int
+vmarea_populate(vmarea_t *vma, uint32_t lopage, uint32_t hipage, int lock)
+{
+        int forwrite = vmarea_populate_forwrite(vma);
+        int writable = forwrite || (lock && (vma->vma_prot & PROT_WRITE));
+        uint32_t vfn;
+        pframe_t *pf;
+        int err = 0;
+
+        KASSERT(curproc->p_vmmap == vma->vma_vmmap);
+        KASSERT(vma->vma_start <= lopage && hipage <= vma->vma_end);
+        KASSERT(PROT_NONE != (vma->vma_prot & (PROT_READ | PROT_WRITE | PROT_EXEC)));
+
+        if (lock) {
+                vma->vma_lockobj = vma->vma_obj;
+                vma->vma_lockobj->mmo_ops->ref(vma->vma_lockobj);
+        }
+
+        for (vfn = lopage; vfn < hipage; ++vfn) {
+                uint32_t pagenum = vma->vma_off + vfn - vma->vma_start;
+
+                if ((!vmarea_page_resident(vma, pagenum, forwrite)
+                     && 0 > (err = proc_charge_rss(curproc, 1)))
+                    || 0 > (err = pframe_lookup(vma->vma_obj, pagenum, forwrite, &pf))) {
+                        break;
+                }
+                if (writable && 0 > (err = pframe_dirty(pf))) {
+                        break;
+                }
+                if (0 > (err = pt_map(curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(vfn),
+                                      pt_virt_to_phys((uintptr_t) pf->pf_addr),
+                                      PD_PRESENT | PD_WRITE | PD_USER,
+                                      PT_PRESENT | PT_USER | (writable ? PT_WRITE : 0)))) {
+                        break;
+                }
+                if (lock) {
+                        pframe_pin(pf);
+                }
+        }
+
+        tlb_flush_range((uintptr_t) PN_TO_ADDR(lopage), vfn - lopage);
+        if (0 > err && lock) {
+                vmarea_unlock(vma, lopage, vfn);
+                vma->vma_lockobj->mmo_ops->put(vma->vma_lockobj);
+                vma->vma_lockobj = NULL;
+        }
+        return err;
+}
+
+/*
+ * Unpins the pages [lopage, hipage) of an area which were pinned by
+ * vmarea_populate(). They stay mapped.
+ *
+ * After a fork, vma_obj is a new shadow object and a write may have
+ * copied a locked page up into it, so the pages are looked up for
+ * reading in vma_lockobj instead, which still leads to the pages that
+ * were pinned. The caller puts vma_lockobj once the whole area is
+ * unlocked.
+ */
+void
+vmarea_unlock(vmarea_t *vma, uint32_t lopage, uint32_t hipage)
+{
+        uint32_t vfn;
+        pframe_t *pf;
+
+        KASSERT(vma->vma_start <= lopage && hipage <= vma->vma_end);
+        KASSERT(NULL != vma->vma_lockobj);
+
+        for (vfn = lopage; vfn < hipage; ++vfn) {
+                uint32_t pagenum = vma->vma_off + vfn - vma->vma_start;
+                /* locked pages are resident, so this cannot block */
+                if (0 > pframe_lookup(vma->vma_lockobj, pagenum, 0, &pf)) {
+                        panic("locked page %#x of area %p is not resident\n",
+                              pagenum, vma);
+                }
+                KASSERT(pframe_is_pinned(pf));
+                pframe_unpin(pf);
+        }
+}
+
+/*
+ * Keeps the shadow chain of every private area in the map short; see
+ * shadow_limit_depth(). fork(2) calls this on the parent's map before
+ * putting a new shadow object on top of each chain.
+ */
+void
+vmmap_collapse(vmmap_t *map)
+{
+        vmarea_t *vma;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                if (NULL != vma->vma_obj->mmo_shadowed) {
+                        shadow_limit_depth(vma->vma_obj);
+                }
+        } list_iterate_end();
+}
+
+/*
+ * Counts the pages resident in each object under the areas of the map,
+ * within the part of the object the area maps, into the rss members of
+ * ru: pages of shadow objects, of anonymous objects, and of anything
+ * else (files and devices). A page found in more than one object of a
+ * chain is counted once for each.
+ */
+void
+vmmap_rss(vmmap_t *map, struct rusage *ru)
+{
+        vmarea_t *vma;
+        mmobj_t *o;
+        pframe_t *pf;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                uint32_t hioff = vma->vma_off + vma->vma_end - vma->vma_start;
+                for (o = vma->vma_obj; NULL != o; o = o->mmo_shadowed) {
+                        unsigned long *count;
+                        if (NULL != o->mmo_shadowed) {
+                                count = &ru->ru_shadowrss;
+                        } else if (mmobj_is_anon(o)) {
+                                count = &ru->ru_anonrss;
+                        } else {
+                                count = &ru->ru_filerss;
+                        }
+                        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                                if (pf->pf_pagenum >= vma->vma_off && pf->pf_pagenum < hioff) {
+                                        ++*count;
+                                }
+                        } list_iterate_end();
+                }
+        } list_iterate_end();
+}
+
+/*
+ * Finds a page under the areas of the map which vmmap_reclaim() can
+ * take: one which is neither pinned nor busy, and if dirty is only
+ * wanted when clean is not set. Only objects which no other area or
+ * object uses are searched, i.e. those which are reached through this
+ * map alone: the chains of MAP_PRIVATE areas, down to the first object
+ * with a second user. Anonymous and shadow objects pin all their pages,
+ * so these are always pages of private mappings of files and devices
+ * nobody else has open or mapped.
+ */
+static pframe_t *
+vmmap_reclaimable(vmmap_t *map, int clean)
+{
+        vmarea_t *vma;
+        mmobj_t *o;
+        pframe_t *pf;
+
+        list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                uint32_t hioff = vma->vma_off + vma->vma_end - vma->vma_start;
+                if (MAP_PRIVATE != (vma->vma_flags & MAP_TYPE)) {
+                        continue;
+                }
+                for (o = vma->vma_obj; NULL != o && 1 == o->mmo_refcount - o->mmo_nrespages;
+                     o = o->mmo_shadowed) {
+                        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                                if (pf->pf_pagenum >= vma->vma_off && pf->pf_pagenum < hioff
+                                    && !pframe_is_pinned(pf) && !pframe_is_busy(pf)
+                                    && (!clean || !pframe_is_dirty(pf))) {
+                                        return pf;
+                                }
+                        } list_iterate_end();
+                }
+        } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * Frees up to npages of the pages resident under the areas of the map,
+ * for a process over its RLIMIT_RSS limit. Clean pages go first, then
+ * dirty ones which are written back first. Pinned pages, and with them
+ * every anonymous and shadow page, are left alone, as there is nowhere
+ * to write them to, and so are pages of objects which other processes,
+ * or other areas of this one, still use (see vmmap_reclaimable()).
+ *
+ * Since cleaning a page blocks, the search starts over after each page.
+ * Returns the number of pages freed.
+ */
+uint32_t
+vmmap_reclaim(vmmap_t *map, uint32_t npages)
+{
+        uint32_t freed = 0;
+        pframe_t *pf;
+        tlb_gather_t tg;
+
+        tlb_gather_init(&tg, pt_get());
+        while (freed < npages) {
+                if (NULL == (pf = vmmap_reclaimable(map, 1))) {
+                        if (NULL == (pf = vmmap_reclaimable(map, 0))) {
+                                break;
+                        }
+                        /* pframe_clean() blocks; look again afterwards */
+                        if (0 > pframe_clean(pf)) {
+                                break;
+                        }
+                        continue;
+                }
+                pframe_free_gather(&tg, pf);
+                ++freed;
+        }
+        tlb_gather_finish(&tg);
+
+        dbg(DBG_VMMAP, "reclaimed %u of %u pages\n", freed, npages);
+        return freed;
+}
+
+/*
+ * Drops an area's reference to its mmobj and takes the area off the
+ * list of areas of its bottom object. Shadow objects the area shared
+ * with other processes' areas may be left with a single user, so the
+ * chains of those areas are collapsed right away.
+ */
+void
+vmarea_put_obj(vmarea_t *vma)
+{
+        mmobj_t *obj = vma->vma_obj;
+        mmobj_t *bottom = mmobj_bottom_obj(obj);
+
+        bottom->mmo_ops->ref(bottom);
+        if (list_link_is_linked(&vma->vma_olink)) {
+                list_remove(&vma->vma_olink);
+        }
+        vma->vma_obj = NULL;
+        obj->mmo_ops->put(obj);
+        if (obj != bottom) {
+                shadow_collapse_siblings(bottom);
+        }
+        bottom->mmo_ops->put(bottom);
+}
+
 /* a debugging routine: dumps the mappings of the given address space. */
 size_t
 vmmap_mapping_info(const void *vmmap, char *buf, size_t osize)
@@ -11,7 +11,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include <stdio.h>
 
@@ -63,6 +65,8 @@ DECL_CMD(sync);
 DECL_CMD(check);
 DECL_CMD(repeat);
 DECL_CMD(parallel);
+DECL_CMD(ulimit);
+DECL_CMD(nice);
 
 typedef struct {
         const char      *cmd_name;
@@ -84,12 +88,14 @@ static cmd_t builtin_cmds[] = {
         { "ln",       cmd_ln,       "link file" },
         { "mkdir",    cmd_mkdir,    "create a directory" },
         { "mv",       cmd_mv,       "move file" },
+        { "nice",     cmd_nice,     "run a command at a lower priority" },
         { "quit",     cmd_exit,     "exit shell" },
         { "rm",       cmd_rm,       "remove file(s)" },
         { "rmdir",    cmd_rmdir,    "remove a directory" },
         { "sync",     cmd_sync,     "sync filesystems" },
         { "repeat",   cmd_repeat,   "repeat a command" },
         { "parallel", cmd_parallel, "run multiple commands in parallel" },
+        { "ulimit",   cmd_ulimit,   "show or set the resident memory limit" },
         { NULL,       NULL,         NULL }
 };
 
@@ -969,6 +975,49 @@ DECL_CMD(mkdir)
         return 0;
 }
 
+DECL_CMD(ulimit)
+{
+        struct rlimit           rlim;
+        char                    *end;
+        long                    kb;
+
+        if (argc > 3 || (argc > 1 && strcmp(argv[1], "-m"))) {
+                fprintf(stderr, "usage: ulimit [-m [<kilobytes> | unlimited]]\n");
+                return 1;
+        }
+
+        if (getrlimit(RLIMIT_RSS, &rlim) < 0) {
+                fprintf(stderr, "ulimit: %s\n", strerror(errno));
+                return 1;
+        }
+
+        if (argc < 3) {
+                if (RLIM_INFINITY == rlim.rlim_cur) {
+                        fprintf(stdout, "unlimited\n");
+                } else {
+                        fprintf(stdout, "%lu\n", rlim.rlim_cur / 1024);
+                }
+                return 0;
+        }
+
+        if (!strcmp(argv[2], "unlimited")) {
+                rlim.rlim_cur = rlim.rlim_max;
+        } else {
+                kb = strtol(argv[2], &end, 10);
+                if (end == argv[2] || '\0' != *end || kb < 0
+                    || (rlim_t) kb >= RLIM_INFINITY / 1024) {
+                        fprintf(stderr, "usage: ulimit [-m [<kilobytes> | unlimited]]\n");
+                        return 1;
+                }
+                rlim.rlim_cur = (rlim_t) kb * 1024;
+        }
+        if (setrlimit(RLIMIT_RSS, &rlim) < 0) {
+                fprintf(stderr, "ulimit: %s\n", strerror(errno));
+                return 1;
+        }
+        return 0;
+}
+
 DECL_CMD(clear)
 {
 #define ESC "\x1B"
@@ -1078,6 +1127,45 @@ DECL_CMD(repeat)
         return 0;
 }
 
+DECL_CMD(nice)
+{
+        redirect_map_t          map;
+        int                     incr = 10;
+        int                     old;
+        int                     cmdbegin = 1;
+        int                     ii;
+
+        if (argc > 2 && !strcmp(argv[1], "-n")) {
+                incr = (int) strtol(argv[2], NULL, 10);
+                cmdbegin = 3;
+        }
+        if (argc <= cmdbegin) {
+                fprintf(stderr, "usage: nice [-n <increment>] command [args ...]\n");
+                return 1;
+        }
+
+        map.rm_nfds = 0;
+        for (ii = 0; ii < 3; ii++) {
+                int             fd;
+
+                fd = dup(io->io_map_fd[ii]);
+                if (fd < 0) {
+                        fprintf(stderr, "nice: dup(%d) failed: %s\n",
+                                io->io_map_fd[ii], strerror(errno));
+                        return 1;
+                }
+
+                add_redirect(&map, fd, ii);
+        }
+
+        /* The command inherits our nice value; put it back afterwards */
+        old = nice(0);
+        nice(incr);
+        execute(argc - cmdbegin, &argv[cmdbegin], &map);
+        nice(old - nice(0));
+        return 0;
+}
+
 DECL_CMD(parallel)
 {
         int i, cmdbegin, ncmds = 0;
@@ -1147,23 +1235,26 @@ DECL_CMD(parallel)
         return status;
 }
 
-static int do_redirect(redirect_map_t *map)
+/* Turns the redirection mappings into file actions for the child. */
+static int build_spawn_actions(redirect_map_t *map,
+                               posix_spawn_file_actions_t *fa)
 {
         int             ii;
         int             newfd, oldfd;
 
+        posix_spawn_file_actions_init(fa);
         for (ii = 0; ii < map->rm_nfds; ii++) {
                 oldfd = map->rm_redir[ii].r_sfd;
                 newfd = map->rm_redir[ii].r_dfd;
 
-                dbg((stderr, "do_redirect: dup2(%d,%d)\n", oldfd, newfd));
+                dbg((stderr, "build_spawn_actions: dup2(%d,%d)\n", oldfd, newfd));
 
-                if (dup2(oldfd, newfd) < 0) {
-                        fprintf(stderr, "do_redirect: dup2() failed: "
-                                "%s\n", strerror(errno));
+                if (posix_spawn_file_actions_adddup2(fa, oldfd, newfd) ||
+                    posix_spawn_file_actions_addclose(fa, oldfd)) {
+                        fprintf(stderr, "sh: too many redirects\n");
+                        posix_spawn_file_actions_destroy(fa);
                         return -1;
                 }
-                close(oldfd);
         }
         return 0;
 }
@@ -1205,8 +1296,9 @@ static int builtin_exec(cmd_t *cmd, int argc, char *argv[], ioenv_t *io)
 
 static int execute(int argc, char *argv[], redirect_map_t *map)
 {
-        int             status, pid;
+        int             status, pid, err;
         cmd_t           *cmd;
+        posix_spawn_file_actions_t actions;
 
         for (cmd = builtin_cmds; cmd->cmd_name; cmd++) {
                 if (!strcmp(cmd->cmd_name, argv[0]))
@@ -1222,28 +1314,26 @@ static int execute(int argc, char *argv[], redirect_map_t *map)
                 return 0;
         }
 
-        if (!(pid = fork())) {
-                if (do_redirect(map) < 0)
-                        exit(1);
-
-                execve(argv[0], argv, my_envp);
-                if (errno == ENOENT) {
-                        char buf[256];
-                        snprintf(buf, 255, "/usr/bin/%s", argv[0]);
-                        execve(buf, argv, my_envp);
+        if (build_spawn_actions(map, &actions) < 0) {
+                cleanup_redirects(map);
+                return -1;
+        }
+        err = posix_spawn(&pid, argv[0], &actions, NULL, argv, my_envp);
+        if (ENOENT == err) {
+                char buf[256];
+                snprintf(buf, 255, "/usr/bin/%s", argv[0]);
+                if (ENOENT == (err = posix_spawn(&pid, buf, &actions, NULL, argv, my_envp)))
                         fprintf(stderr, "sh: command not found: %s\n", argv[0]);
-                } else
-                        fprintf(stderr, "sh: exec failed for %s: %s\n",
-                                argv[0], strerror(errno));
-                exit(1);
-        } else {
-                if (0 > pid) {
-                        fprintf(stderr, "sh: fork failed errno = %d\n", errno);
-                }
         }
+        if (err && ENOENT != err)
+                fprintf(stderr, "sh: exec failed for %s: %s\n",
+                        argv[0], strerror(err));
+        posix_spawn_file_actions_destroy(&actions);
 
         cleanup_redirects(map);
-        int ret = wait(&status);
+        if (err)
+                return -1;
+        int ret = waitpid(pid, 0, &status);
         if (status == EFAULT) {
                 fprintf(stderr, "sh: child process accessed invalid memory\n");
         }
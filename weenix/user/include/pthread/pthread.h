@@ -5,8 +5,24 @@ struct pthread_cond;
 struct pthread_mutex;
 
 typedef struct pthread          *pthread_t;
-typedef struct pthread_mutex    *pthread_mutex_t;
-typedef struct pthread_cond     *pthread_cond_t;
+
+/* Mutexes and condition variables are built on futex(2): taking a free
+ * mutex, or signalling a condition variable nobody waits on, makes no
+ * system call. They only need to be initialized (by the *_init()
+ * functions or the initializers below) and can be shared between
+ * processes by putting them in a MAP_SHARED mapping. */
+typedef struct pthread_mutex {
+        volatile int    pm_state;       /* 0 if unlocked, 1 if locked, 2 if
+                                         * locked and threads may wait */
+} pthread_mutex_t;
+
+typedef struct pthread_cond {
+        volatile int    pc_seq;         /* changed by every signal */
+        volatile int    pc_waiters;     /* threads in pthread_cond_wait() */
+} pthread_cond_t;
+
+#define PTHREAD_MUTEX_INITIALIZER       { 0 }
+#define PTHREAD_COND_INITIALIZER        { 0, 0 }
 
 /* Attributes NYI */
 typedef int pthread_attr_t;
@@ -28,6 +44,7 @@ int             pthread_detach(pthread_t thr);
 int             pthread_equal(pthread_t, pthread_t);
 void            pthread_exit(void *retval);
 int             pthread_join(pthread_t thr, void **retval);
+int             pthread_mutex_destroy(pthread_mutex_t *mtx);
 int             pthread_mutex_init(pthread_mutex_t *mtx,
                                    const pthread_mutexattr_t *);
 int             pthread_mutex_lock(pthread_mutex_t *mtx);
@@ -57,7 +74,6 @@ int             pthread_mutexattr_init(pthread_mutexattr_t *);
 int             pthread_mutexattr_destroy(pthread_mutexattr_t *);
 int             pthread_mutexattr_gettype(pthread_mutexattr_t *, int *);
 int             pthread_mutexattr_settype(pthread_mutexattr_t *, int);
-int             pthread_mutex_destroy(pthread_mutex_t *);
 int             pthread_attr_getstacksize(const pthread_attr_t *, size_t *);
 int             pthread_attr_getstackaddr(const pthread_attr_t *, void **);
 int             pthread_attr_getguardsize(const pthread_attr_t *, size_t *);
@@ -0,0 +1,19 @@
+/*
+ *  semaphore.h - Counting semaphores, built on futex(2)
+ */
+#pragma once
+
+/* Posting, and waiting while the count is above zero, make no system
+ * call. A semaphore in a MAP_SHARED mapping can be used between
+ * processes. */
+typedef struct sem {
+        volatile int    sem_value;
+        volatile int    sem_waiters;    /* threads which found it at 0 */
+} sem_t;
+
+int     sem_init(sem_t *sem, int pshared, unsigned int value);
+int     sem_destroy(sem_t *sem);
+int     sem_wait(sem_t *sem);
+int     sem_trywait(sem_t *sem);
+int     sem_post(sem_t *sem);
+int     sem_getvalue(sem_t *sem, int *sval);
@@ -0,0 +1,32 @@
+/*
+ *  spawn.h - Create a process running a new program in one step
+ */
+#pragma once
+
+#include "sys/types.h"
+#include "weenix/syscall.h"
+
+/* File actions are applied in the child, in the order they were added,
+ * before the new program is loaded. */
+typedef struct posix_spawn_file_actions {
+        int                     fa_count;
+        spawn_file_action_t     fa_actions[SPAWN_MAX_ACTIONS];
+} posix_spawn_file_actions_t;
+
+/* No spawn attributes are supported; pass NULL. */
+typedef struct posix_spawnattr posix_spawnattr_t;
+
+int     posix_spawn_file_actions_init(posix_spawn_file_actions_t *fa);
+int     posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *fa);
+int     posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *fa,
+                                         int fd, int newfd);
+int     posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *fa,
+                                          int fd);
+
+/* Returns 0 and the child's pid in *pid, or an error number. Failures
+ * to apply a file action or to load the program are reported here, not
+ * by the child exiting. */
+int     posix_spawn(pid_t *pid, const char *path,
+                    const posix_spawn_file_actions_t *fa,
+                    const posix_spawnattr_t *attrp,
+                    char *const argv[], char *const envp[]);
@@ -23,3 +23,14 @@
 */
 #define MAP_FIXED       4
 #define MAP_ANON        8
+#define MAP_POPULATE    16    /* Fault in the whole mapping up front. */
+#define MAP_LOCKED      32    /* Pin the pages of the mapping (see mlock()). */
+#define MAP_HUGE        64    /* Back private anonymous memory with 4MB pages. */
+
+/* Advice to madvise().
+*/
+#define MADV_NORMAL     0     /* No special treatment. */
+#define MADV_RANDOM     1     /* Expect random page references. */
+#define MADV_SEQUENTIAL 2     /* Expect sequential page references. */
+#define MADV_WILLNEED   3     /* Will need these pages. */
+#define MADV_DONTNEED   4     /* Don't need these pages. */
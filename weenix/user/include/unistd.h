@@ -14,9 +14,12 @@
 #endif
 
 struct dirent;
+struct rusage;
+struct rlimit;
 
 /* User exec-related */
 int     fork(void);
+pid_t   vfork(void);
 int     execl(const char *filename, const char *arg, ...); /* NYI */
 int     execle(const char *filename, const char *arg, ...); /* NYI */
 int     execv(const char *filename, char *const argv[]); /* NYI */
@@ -30,6 +33,9 @@ void    thr_exit(int status);
 int     thr_errno(void);
 void    thr_set_errno(int n);
 void    yield(void);
+int     nice(int incr);
+int     futex(int *uaddr, int op, int val);
+unsigned int sleep(unsigned int seconds);
 pid_t   getpid(void);
 int     halt(void);
 void    sync(void);
@@ -56,6 +62,12 @@ int     stat(const char *path, struct stat *buf);
 /* VM-related */
 void    *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
 int     munmap(void *addr, size_t len);
+int     madvise(void *addr, size_t len, int advice);
+int     mlock(const void *addr, size_t len);
+int     munlock(const void *addr, size_t len);
+int     getrusage(int who, struct rusage *usage);
+int     getrlimit(int resource, struct rlimit *rlim);
+int     setrlimit(int resource, const struct rlimit *rlim);
 int     brk(void *addr);
 void    *sbrk(int incr);
 
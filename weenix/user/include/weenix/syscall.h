@@ -2,11 +2,13 @@
 
 /* Kernel and user header (via symlink) */
 
+#ifndef __ASSEMBLY__
 #ifdef __KERNEL__
 #include "types.h"
 #else
 #include "sys/types.h"
 #endif
+#endif
 
 /* Trap number for syscalls */
 #define INTR_SYSCALL 0x2e
@@ -56,6 +58,18 @@
 #define SYS_mount               45
 #define SYS_umount              46
 #define SYS_stat                47
+#define SYS_madvise             48
+#define SYS_mlock               49
+#define SYS_munlock             50
+#define SYS_vfork               51
+#define SYS_spawn               52
+#define SYS_getrusage           53
+#define SYS_getrlimit           54
+#define SYS_setrlimit           55
+#define SYS_nice                56
+#define SYS_futex               57
+#define SYS_nanosleep           58
+#define SYS_clock_gettime       59
 
 /*
  * ... what does the scouter say about his syscall?
@@ -65,8 +79,13 @@
 #define SYS_debug               9001
 #define SYS_kshell              9002
 
+#ifndef __ASSEMBLY__
+
 struct regs;
 struct stat;
+struct rusage;
+struct rlimit;
+struct timespec;
 
 typedef struct argstr {
         const char *as_str;
@@ -98,6 +117,38 @@ typedef struct munmap_args {
         size_t  len;
 } munmap_args_t;
 
+typedef struct madvise_args {
+        void   *addr;
+        size_t  len;
+        int     advice;
+} madvise_args_t;
+
+typedef struct mlock_args {
+        void   *addr;
+        size_t  len;
+} mlock_args_t;
+
+/* futex(2) operations */
+#define FUTEX_WAIT              0
+#define FUTEX_WAKE              1
+
+typedef struct futex_args {
+        int    *uaddr;
+        int     op;
+        int     val;    /* FUTEX_WAIT: the value *uaddr must hold to sleep,
+                         * FUTEX_WAKE: the most threads to wake */
+} futex_args_t;
+
+typedef struct nanosleep_args {
+        const struct timespec *req;
+        struct timespec *rem;
+} nanosleep_args_t;
+
+typedef struct clock_gettime_args {
+        int              clock_id;
+        struct timespec *tp;
+} clock_gettime_args_t;
+
 typedef struct open_args {
         argstr_t filename;
         int      flags;
@@ -132,6 +183,24 @@ typedef struct execve_args {
         argvec_t envp;
 } execve_args_t;
 
+/* Most file actions a single spawn(2) will accept */
+#define SPAWN_MAX_ACTIONS       32
+
+/* A file action applied in the child by spawn(2) before the new program
+ * is loaded: dup2(sfa_fd, sfa_newfd), or close(sfa_fd) if sfa_newfd is -1 */
+typedef struct spawn_file_action {
+        int sfa_fd;
+        int sfa_newfd;
+} spawn_file_action_t;
+
+typedef struct spawn_args {
+        argstr_t             filename;
+        argvec_t             argv;
+        argvec_t             envp;
+        spawn_file_action_t *actions;
+        size_t               nactions;
+} spawn_args_t;
+
 typedef struct rename_args {
         argstr_t oldname;
         argstr_t newname;
@@ -162,9 +231,21 @@ typedef struct mount_args {
 } mount_args_t;
 #endif
 
+typedef struct getrusage_args {
+        int            who;
+        struct rusage *usage;
+} getrusage_args_t;
+
+typedef struct rlimit_args {
+        int            resource;
+        struct rlimit *rlim;
+} rlimit_args_t;
+
 typedef struct stat_args {
         argstr_t     path;
         struct stat *buf;
 } stat_args_t;
 
 struct utsname;
+
+#endif /* __ASSEMBLY__ */
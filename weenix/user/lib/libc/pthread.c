@@ -0,0 +1,203 @@
+#include "sys/types.h"
+#include "stddef.h"
+
+#include "errno.h"
+#include "limits.h"
+#include "unistd.h"
+
+#include "pthread/pthread.h"
+#include "semaphore.h"
+#include "weenix/syscall.h"
+
+/*
+ * Mutexes, condition variables and semaphores. Each keeps its state in
+ * ints which are changed with atomic instructions, and only calls
+ * futex(2) to sleep when it has to wait, or to wake a thread when one
+ * may be waiting.
+ */
+
+/* Sets *p to 'val' if it holds 'old'. Returns what *p held. */
+static inline int
+atomic_cmpxchg(volatile int *p, int old, int val)
+{
+        __asm__ volatile("lock; cmpxchgl %2, %1"
+                         : "+a"(old), "+m"(*p) : "r"(val) : "memory");
+        return old;
+}
+
+/* Sets *p to 'val'. Returns what *p held. */
+static inline int
+atomic_xchg(volatile int *p, int val)
+{
+        __asm__ volatile("xchgl %0, %1" : "+r"(val), "+m"(*p) :: "memory");
+        return val;
+}
+
+/* Adds 'n' to *p. Returns what *p held. */
+static inline int
+atomic_add(volatile int *p, int n)
+{
+        __asm__ volatile("lock; xaddl %0, %1" : "+r"(n), "+m"(*p) :: "memory");
+        return n;
+}
+
+int pthread_mutex_init(pthread_mutex_t *mtx, const pthread_mutexattr_t *attr)
+{
+        mtx->pm_state = 0;
+        return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mtx)
+{
+        return 0 == mtx->pm_state ? 0 : EBUSY;
+}
+
+/* Takes the mutex, sleeping for as long as it is held. The mutex is
+ * left marked as waited for, so that its unlock wakes up whoever else
+ * may be sleeping. */
+static void
+mutex_wait(pthread_mutex_t *mtx)
+{
+        while (0 != atomic_xchg(&mtx->pm_state, 2)) {
+                futex((int *)&mtx->pm_state, FUTEX_WAIT, 2);
+        }
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mtx)
+{
+        if (0 != atomic_cmpxchg(&mtx->pm_state, 0, 1)) {
+                mutex_wait(mtx);
+        }
+        return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mtx)
+{
+        return 0 == atomic_cmpxchg(&mtx->pm_state, 0, 1) ? 0 : EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mtx)
+{
+        if (2 == atomic_xchg(&mtx->pm_state, 0)) {
+                futex((int *)&mtx->pm_state, FUTEX_WAKE, 1);
+        }
+        return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+        cond->pc_seq = 0;
+        cond->pc_waiters = 0;
+        return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+        return 0 == cond->pc_waiters ? 0 : EBUSY;
+}
+
+/*
+ * The waiter sleeps for as long as pc_seq holds what it did when the
+ * waiter last held the mutex, so a signal between unlocking the mutex
+ * and sleeping is not missed. Waiters are counted so that signals can
+ * skip the system call when nobody waits; that count is only exact
+ * when signalling with the mutex held.
+ */
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mtx)
+{
+        int seq = cond->pc_seq;
+
+        atomic_add(&cond->pc_waiters, 1);
+        pthread_mutex_unlock(mtx);
+
+        futex((int *)&cond->pc_seq, FUTEX_WAIT, seq);
+
+        atomic_add(&cond->pc_waiters, -1);
+        mutex_wait(mtx);
+        return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+        if (0 < cond->pc_waiters) {
+                atomic_add(&cond->pc_seq, 1);
+                futex((int *)&cond->pc_seq, FUTEX_WAKE, 1);
+        }
+        return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+        if (0 < cond->pc_waiters) {
+                atomic_add(&cond->pc_seq, 1);
+                futex((int *)&cond->pc_seq, FUTEX_WAKE, INT_MAX);
+        }
+        return 0;
+}
+
+int sem_init(sem_t *sem, int pshared, unsigned int value)
+{
+        if (value > INT_MAX) {
+                errno = EINVAL;
+                return -1;
+        }
+        sem->sem_value = value;
+        sem->sem_waiters = 0;
+        return 0;
+}
+
+int sem_destroy(sem_t *sem)
+{
+        return 0;
+}
+
+/* Decrements the count if it is above 0. Returns 1 if it was. */
+static int
+sem_take(sem_t *sem)
+{
+        int val;
+
+        while (0 < (val = sem->sem_value)) {
+                if (val == atomic_cmpxchg(&sem->sem_value, val, val - 1)) {
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+int sem_trywait(sem_t *sem)
+{
+        if (!sem_take(sem)) {
+                errno = EAGAIN;
+                return -1;
+        }
+        return 0;
+}
+
+/* A poster increments the count before it checks for waiters, and a
+ * waiter counts itself before it sleeps on the count being 0, so one
+ * of them always sees the other. */
+int sem_wait(sem_t *sem)
+{
+        while (!sem_take(sem)) {
+                atomic_add(&sem->sem_waiters, 1);
+                futex((int *)&sem->sem_value, FUTEX_WAIT, 0);
+                atomic_add(&sem->sem_waiters, -1);
+        }
+        return 0;
+}
+
+int sem_post(sem_t *sem)
+{
+        atomic_add(&sem->sem_value, 1);
+        if (0 < sem->sem_waiters) {
+                futex((int *)&sem->sem_value, FUTEX_WAKE, 1);
+        }
+        return 0;
+}
+
+int sem_getvalue(sem_t *sem, int *sval)
+{
+        *sval = sem->sem_value;
+        return 0;
+}
@@ -0,0 +1,110 @@
+#include "sys/types.h"
+
+#include "errno.h"
+#include "string.h"
+#include "stdlib.h"
+
+#include "spawn.h"
+#include "weenix/trap.h"
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *fa)
+{
+        fa->fa_count = 0;
+        return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *fa)
+{
+        return 0;
+}
+
+static int spawn_add_action(posix_spawn_file_actions_t *fa, int fd, int newfd)
+{
+        if (fa->fa_count >= SPAWN_MAX_ACTIONS) {
+                return ENOMEM;
+        }
+        fa->fa_actions[fa->fa_count].sfa_fd = fd;
+        fa->fa_actions[fa->fa_count].sfa_newfd = newfd;
+        fa->fa_count++;
+        return 0;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *fa,
+                                     int fd, int newfd)
+{
+        if (0 > fd || 0 > newfd) {
+                return EBADF;
+        }
+        return spawn_add_action(fa, fd, newfd);
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *fa, int fd)
+{
+        if (0 > fd) {
+                return EBADF;
+        }
+        return spawn_add_action(fa, fd, -1);
+}
+
+/* Builds the argvec_t for a NULL-terminated string vector. Returns 0, or
+ * -1 if out of memory. */
+static int spawn_vec(argvec_t *av, char *const vec[])
+{
+        size_t i;
+
+        for (i = 0; vec[i] != NULL; i++)
+                ;
+        av->av_len = i;
+        if (NULL == (av->av_vec = malloc((av->av_len + 1) * sizeof(argstr_t)))) {
+                return -1;
+        }
+        for (i = 0; vec[i] != NULL; i++) {
+                av->av_vec[i].as_len = strlen(vec[i]);
+                av->av_vec[i].as_str = vec[i];
+        }
+        av->av_vec[i].as_len = 0;
+        av->av_vec[i].as_str = NULL;
+        return 0;
+}
+
+int posix_spawn(pid_t *pid, const char *path,
+                const posix_spawn_file_actions_t *fa,
+                const posix_spawnattr_t *attrp,
+                char *const argv[], char *const envp[])
+{
+        spawn_args_t    args;
+        int             ret;
+
+        if (NULL != attrp) {
+                return EINVAL;
+        }
+
+        args.filename.as_len = strlen(path);
+        args.filename.as_str = path;
+        if (NULL != fa) {
+                args.actions = (spawn_file_action_t *) fa->fa_actions;
+                args.nactions = fa->fa_count;
+        } else {
+                args.actions = NULL;
+                args.nactions = 0;
+        }
+
+        if (0 > spawn_vec(&args.argv, argv)) {
+                return ENOMEM;
+        }
+        if (0 > spawn_vec(&args.envp, envp)) {
+                free(args.argv.av_vec);
+                return ENOMEM;
+        }
+
+        ret = trap(SYS_spawn, (uint32_t) &args);
+        free(args.argv.av_vec);
+        free(args.envp.av_vec);
+        if (0 > ret) {
+                return errno;
+        }
+        if (NULL != pid) {
+                *pid = ret;
+        }
+        return 0;
+}
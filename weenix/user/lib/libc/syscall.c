@@ -5,6 +5,7 @@
 #include "stdlib.h"
 
 #include "unistd.h"
+#include "time.h"
 #include "weenix/trap.h"
 
 #include "dirent.h"
@@ -95,7 +96,7 @@ void yield(void)
         /* Due to a Bochs bug, the yield syscall itself is highly unyielding
          * (for instance, it's impossible to type while a process is in a yield
          * loop. This is good enough. */
-        (fork() ? wait(NULL) : exit(0));
+        (vfork() ? wait(NULL) : _exit(0));
 }
 
 pid_t wait(int *status)
@@ -159,6 +160,130 @@ int munmap(void *addr, size_t len)
         return trap(SYS_munmap, (uint32_t) &args);
 }
 
+int madvise(void *addr, size_t len, int advice)
+{
+        madvise_args_t args;
+
+        args.addr = addr;
+        args.len = len;
+        args.advice = advice;
+
+        return trap(SYS_madvise, (uint32_t) &args);
+}
+
+int mlock(const void *addr, size_t len)
+{
+        mlock_args_t args;
+
+        args.addr = (void *) addr;
+        args.len = len;
+
+        return trap(SYS_mlock, (uint32_t) &args);
+}
+
+int munlock(const void *addr, size_t len)
+{
+        mlock_args_t args;
+
+        args.addr = (void *) addr;
+        args.len = len;
+
+        return trap(SYS_munlock, (uint32_t) &args);
+}
+
+int getrusage(int who, struct rusage *usage)
+{
+        getrusage_args_t args;
+
+        args.who = who;
+        args.usage = usage;
+
+        return trap(SYS_getrusage, (uint32_t) &args);
+}
+
+int nice(int incr)
+{
+        return trap(SYS_nice, (uint32_t) incr);
+}
+
+int futex(int *uaddr, int op, int val)
+{
+        futex_args_t args;
+
+        args.uaddr = uaddr;
+        args.op = op;
+        args.val = val;
+
+        return trap(SYS_futex, (uint32_t) &args);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+        nanosleep_args_t args;
+
+        args.req = req;
+        args.rem = rem;
+
+        return trap(SYS_nanosleep, (uint32_t) &args);
+}
+
+/* Reads CLOCK_MONOTONIC off the clock page (see time.h) when it can,
+ * without trapping into the kernel. */
+int clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+        const struct clock_page *cp = (const struct clock_page *) CLOCK_PAGE_ADDR;
+        clock_gettime_args_t args;
+        uint64_t tsc, count, ns;
+
+        if (CLOCK_MONOTONIC == clock_id && 0 != cp->cp_mult) {
+                __asm__ volatile("rdtsc" : "=A"(tsc));
+                count = tsc - cp->cp_tsc;
+                ns = cp->cp_ns
+                     + (((count >> 32) * cp->cp_mult) << (32 - cp->cp_shift))
+                     + (((count & 0xffffffff) * cp->cp_mult) >> cp->cp_shift);
+                tp->tv_sec = ns / NSEC_PER_SEC;
+                tp->tv_nsec = ns % NSEC_PER_SEC;
+                return 0;
+        }
+
+        args.clock_id = clock_id;
+        args.tp = tp;
+
+        return trap(SYS_clock_gettime, (uint32_t) &args);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+        struct timespec req, rem;
+
+        req.tv_sec = seconds;
+        req.tv_nsec = 0;
+        if (0 > nanosleep(&req, &rem)) {
+                return rem.tv_sec + (0 < rem.tv_nsec);
+        }
+        return 0;
+}
+
+int getrlimit(int resource, struct rlimit *rlim)
+{
+        rlimit_args_t args;
+
+        args.resource = resource;
+        args.rlim = rlim;
+
+        return trap(SYS_getrlimit, (uint32_t) &args);
+}
+
+int setrlimit(int resource, const struct rlimit *rlim)
+{
+        rlimit_args_t args;
+
+        args.resource = resource;
+        args.rlim = (struct rlimit *) rlim;
+
+        return trap(SYS_setrlimit, (uint32_t) &args);
+}
+
 void sync(void)
 {
         trap(SYS_sync, 0);
@@ -0,0 +1,257 @@
+/*
+ * Tests the newer process, synchronization, memory and time system
+ * calls from user space: futex(2) and the semaphores built on it,
+ * madvise(2) and mlock(2), vfork(2), posix_spawn() and the clocks.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <weenix/syscall.h>
+#include <stdio.h>
+
+#include <test/test.h>
+
+#include "page.h"
+
+/* Asserts that statement fails with the given errno */
+#define assert_errno(err, statement) \
+        test_assert(-1 == (statement) && (err) == errno, "unexpected errno %d", errno)
+
+/* Maps a zeroed page shared with any children forked afterwards */
+static void *map_shared_page(void)
+{
+        void *addr = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANON, -1, 0);
+        test_assert(MAP_FAILED != addr, NULL);
+        return addr;
+}
+
+static int test_futex(void)
+{
+        int *word, status, i;
+        pid_t pid;
+
+        printf("Testing futex wait and wake\n");
+
+        word = map_shared_page();
+
+        /* A wait only sleeps while the word holds the given value */
+        assert_errno(EAGAIN, futex(word, FUTEX_WAIT, 1));
+        assert_errno(EINVAL, futex((int *)((char *) word + 1), FUTEX_WAIT, 0));
+        test_assert(0 == futex(word, FUTEX_WAKE, 1), NULL);
+
+        /* word[1] says the child is about to wait, word[0] releases it */
+        test_assert(0 <= (pid = fork()), NULL);
+        if (0 == pid) {
+                word[1] = 1;
+                while (0 == word[0]) {
+                        if (-1 == futex(word, FUTEX_WAIT, 0) && EAGAIN != errno) {
+                                exit(1);
+                        }
+                }
+                exit(2 == word[0] ? 0 : 1);
+        }
+        while (0 == word[1]) {
+                yield();
+        }
+        /* give the child a chance to get to sleep */
+        for (i = 0; i < 10; i++) {
+                yield();
+        }
+        word[0] = 2;
+        test_assert(0 <= futex(word, FUTEX_WAKE, 1), NULL);
+        test_assert(pid == waitpid(pid, 0, &status), NULL);
+        test_assert(0 == status, "child was not woken cleanly");
+
+        test_assert(0 == munmap(word, PAGE_SIZE), NULL);
+        return 0;
+}
+
+static int test_semaphore(void)
+{
+        struct {
+                sem_t   ping;
+                sem_t   pong;
+                int     value;
+        } *shared;
+        int status, sval;
+        pid_t pid;
+
+        printf("Testing a semaphore handoff between processes\n");
+
+        shared = map_shared_page();
+        test_assert(0 == sem_init(&shared->ping, 1, 0), NULL);
+        test_assert(0 == sem_init(&shared->pong, 1, 0), NULL);
+        assert_errno(EAGAIN, sem_trywait(&shared->ping));
+
+        test_assert(0 <= (pid = fork()), NULL);
+        if (0 == pid) {
+                if (0 != sem_wait(&shared->ping) || 42 != shared->value) {
+                        exit(1);
+                }
+                shared->value = 43;
+                exit(0 == sem_post(&shared->pong) ? 0 : 1);
+        }
+        shared->value = 42;
+        test_assert(0 == sem_post(&shared->ping), NULL);
+        test_assert(0 == sem_wait(&shared->pong), NULL);
+        test_assert(43 == shared->value, "handoff lost the child's write");
+        test_assert(pid == waitpid(pid, 0, &status), NULL);
+        test_assert(0 == status, NULL);
+
+        test_assert(0 == sem_getvalue(&shared->ping, &sval) && 0 == sval, NULL);
+        test_assert(0 == sem_destroy(&shared->ping), NULL);
+        test_assert(0 == sem_destroy(&shared->pong), NULL);
+        test_assert(0 == munmap(shared, PAGE_SIZE), NULL);
+        return 0;
+}
+
+static int test_madvise_mlock(void)
+{
+        char *addr;
+
+        printf("Testing madvise and mlock arguments\n");
+
+        test_assert(MAP_FAILED != (addr = mmap(NULL, PAGE_SIZE * 2, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANON, -1, 0)), NULL);
+        test_assert(0 == munmap(addr + PAGE_SIZE, PAGE_SIZE), NULL);
+
+        assert_errno(EINVAL, madvise(addr + 1, PAGE_SIZE, MADV_NORMAL));
+        assert_errno(EINVAL, madvise(addr, PAGE_SIZE, -1));
+        assert_errno(EINVAL, madvise(NULL, PAGE_SIZE, MADV_NORMAL));
+        assert_errno(ENOMEM, madvise(addr, PAGE_SIZE * 2, MADV_NORMAL));
+        test_assert(0 == madvise(addr, 0, MADV_NORMAL), NULL);
+        test_assert(0 == madvise(addr, PAGE_SIZE, MADV_SEQUENTIAL), NULL);
+        test_assert(0 == madvise(addr, PAGE_SIZE, MADV_WILLNEED), NULL);
+
+        assert_errno(EINVAL, mlock(addr + 1, PAGE_SIZE));
+        assert_errno(ENOMEM, mlock(addr, PAGE_SIZE * 2));
+        assert_errno(EINVAL, munlock(addr + 1, PAGE_SIZE));
+        assert_errno(ENOMEM, munlock(addr, PAGE_SIZE * 2));
+
+        /* Locked pages cannot be dropped */
+        addr[0] = 'x';
+        test_assert(0 == mlock(addr, PAGE_SIZE), NULL);
+        assert_errno(EINVAL, madvise(addr, PAGE_SIZE, MADV_DONTNEED));
+        test_assert('x' == addr[0], NULL);
+        test_assert(0 == munlock(addr, PAGE_SIZE), NULL);
+
+        /* and once unlocked, private anonymous memory reads back as zeros */
+        test_assert(0 == madvise(addr, PAGE_SIZE, MADV_DONTNEED), NULL);
+        test_assert('\0' == addr[0], NULL);
+
+        test_assert(0 == munmap(addr, PAGE_SIZE), NULL);
+        return 0;
+}
+
+static int test_vfork(void)
+{
+        volatile int touched = 0;
+        int status;
+        pid_t pid;
+
+        printf("Testing a vfork child which exits without exec\n");
+
+        /* The child runs in our address space until it exits, and we
+         * do not run again until then */
+        test_assert(0 <= (pid = vfork()), NULL);
+        if (0 == pid) {
+                touched = 1;
+                _exit(7);
+        }
+        test_assert(1 == touched, "vfork child does not share our memory");
+        test_assert(pid == waitpid(pid, 0, &status), NULL);
+        test_assert(7 == status, "unexpected exit status %d", status);
+        return 0;
+}
+
+static int test_spawn(void)
+{
+        posix_spawn_file_actions_t fa;
+        char *argv[] = { "hello", NULL };
+        char *envp[] = { NULL };
+        int fd, status;
+        pid_t pid;
+
+        printf("Testing a spawn whose file action fails\n");
+
+        /* fd is closed, so duplicating it in the child fails */
+        test_assert(0 <= (fd = open("/dev/null", O_RDONLY, 0)), NULL);
+        test_assert(0 == close(fd), NULL);
+
+        test_assert(0 == posix_spawn_file_actions_init(&fa), NULL);
+        test_assert(EBADF == posix_spawn_file_actions_adddup2(&fa, -1, 1), NULL);
+        test_assert(0 == posix_spawn_file_actions_adddup2(&fa, fd, 1), NULL);
+        pid = -1;
+        test_assert(EBADF == posix_spawn(&pid, "/usr/bin/hello", &fa, NULL, argv, envp), NULL);
+        test_assert(-1 == pid, "failed spawn returned a pid");
+        test_assert(0 == posix_spawn_file_actions_destroy(&fa), NULL);
+
+        /* and the failed child has already been reaped */
+        assert_errno(ECHILD, waitpid(-1, 0, &status));
+        return 0;
+}
+
+static int test_clock(void)
+{
+        struct timespec before, after, req;
+        long long ns;
+
+        printf("Testing nanosleep against clock_gettime\n");
+
+        assert_errno(EINVAL, clock_gettime(-1, &before));
+        req.tv_sec = 0;
+        req.tv_nsec = NSEC_PER_SEC;
+        assert_errno(EINVAL, nanosleep(&req, NULL));
+
+        test_assert(0 == clock_gettime(CLOCK_MONOTONIC, &before), NULL);
+        test_assert(0 <= before.tv_nsec && NSEC_PER_SEC > before.tv_nsec, NULL);
+        req.tv_nsec = 50000000;
+        test_assert(0 == nanosleep(&req, NULL), NULL);
+        test_assert(0 == clock_gettime(CLOCK_MONOTONIC, &after), NULL);
+
+        ns = (long long)(after.tv_sec - before.tv_sec) * NSEC_PER_SEC
+             + (after.tv_nsec - before.tv_nsec);
+        test_assert(ns >= req.tv_nsec, "slept only %d ns", (int) ns);
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        int status;
+
+        if (argc != 1) {
+                fprintf(stderr, "USAGE: apitest\n");
+                return 1;
+        }
+
+        /* Run each test in its own process, so that a crash or a stray
+         * child does not take the others down with it */
+#define childtest(fun) \
+        do { \
+                test_fork_begin() { \
+                        return fun(); \
+                } test_fork_end(&status); \
+                test_assert(EFAULT != status, "Test process shouldn't segfault!"); \
+                test_assert(0 == status, "Test process returned error"); \
+        } while (0)
+
+        test_init();
+        childtest(test_futex);
+        childtest(test_semaphore);
+        childtest(test_madvise_mlock);
+        childtest(test_vfork);
+        childtest(test_spawn);
+        childtest(test_clock);
+        test_fini();
+
+        return 0;
+}